@@ -0,0 +1,4600 @@
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define assert(x)                                                              \
+  if (!(x))                                                                    \
+  __builtin_trap()
+#define nelem(x) (sizeof(x) / sizeof(*(x)))
+#define endof(x) ((x) + nelem(x))
+
+#ifndef EXP
+#define EXP 16
+#endif
+#ifndef NTHREAD
+#define NTHREAD 16
+#endif
+#ifndef SHORTNAMESIZE
+#define SHORTNAMESIZE 16
+#endif
+#ifndef HTSTATS
+#define HTSTATS 0
+#endif
+
+/* KERNEL functions are compiled once per x86-64 microarchitecture level and
+ * the dynamic loader picks the best one for the host, so that one binary
+ * uses AVX2 or AVX-512 where they exist without risking SIGILL where they do
+ * not. This needs ifunc support, hence glibc on Linux. */
+#if defined(__x86_64__) && defined(__linux__) && !defined(NOCLONES)
+#define KERNEL                                                                 \
+  __attribute__((target_clones("default", "arch=x86-64-v2",                   \
+                               "arch=x86-64-v3", "arch=x86-64-v4")))
+#else
+#define KERNEL
+#endif
+
+#define CHUNKSIZE (2 << 20)
+#define NAMEMAX 100
+#define LINEMAX (NAMEMAX + sizeof(";-99.9\n"))
+#define MAXRECORDS (1 << 14)
+#define PROBEMAX 64
+#define REHASHMAX 16
+
+struct record {
+  char shortname[SHORTNAMESIZE];
+  const char *fullname;
+  int64_t total;
+  int32_t num;
+  int32_t min, max;
+};
+
+int namelen(const struct record *r) {
+  return strchr(r->fullname, ';') - r->fullname;
+}
+
+/* Hardware counters for -stats and -bench. A set of counters counts the user
+ * space events of the thread that opened it. Counters that cannot be opened,
+ * because of perf_event_paranoid or outside Linux, read as -1. */
+enum {
+  CYCLES,
+  INSTRUCTIONS,
+  L1DMISSES,
+  LLCMISSES,
+  BRANCHMISSES,
+  DTLBMISSES,
+  NCOUNTER
+};
+
+const char *countername[NCOUNTER] = {"cycles",        "instructions",
+                                     "L1d-misses",    "LLC-misses",
+                                     "branch-misses", "dTLB-misses"};
+
+#ifdef __linux__
+#define CACHEMISS(cache)                                                       \
+  ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 |                                \
+   PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+const struct {
+  uint32_t type;
+  uint64_t config;
+} counterevent[NCOUNTER] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHEMISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHEMISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+#endif
+
+struct counters {
+  int fd[NCOUNTER];
+};
+
+struct sample {
+  int64_t ns, count[NCOUNTER];
+};
+
+struct span {
+  int64_t start, end, bytes;
+};
+
+void countersopen(struct counters *c) {
+  int i;
+
+  for (i = 0; i < NCOUNTER; i++) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counterevent[i].type;
+    attr.config = counterevent[i].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    c->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    c->fd[i] = -1;
+#endif
+  }
+}
+
+void countersclose(struct counters *c) {
+  int i;
+  for (i = 0; i < NCOUNTER; i++)
+    if (c->fd[i] >= 0)
+      close(c->fd[i]);
+}
+
+int64_t nanotime(void) {
+  struct timespec now;
+  assert(!clock_gettime(CLOCK_MONOTONIC, &now));
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* The kernel multiplexes events when there are more than the PMU can count
+ * at once, so counts are scaled up by the fraction of time they ran. */
+void countersread(struct counters *c, struct sample *s) {
+  uint64_t v[3];
+  int i;
+
+  s->ns = nanotime();
+  for (i = 0; i < NCOUNTER; i++)
+    if (c->fd[i] < 0 || read(c->fd[i], v, sizeof(v)) != sizeof(v))
+      s->count[i] = -1;
+    else
+      s->count[i] = v[2] ? (double)v[0] * (double)v[1] / (double)v[2] : 0;
+}
+
+/* sampleadd adds the difference between end and start to sum. */
+void sampleadd(struct sample *sum, struct sample *start, struct sample *end) {
+  int i;
+  sum->ns += end->ns - start->ns;
+  for (i = 0; i < NCOUNTER; i++)
+    if (sum->count[i] < 0 || start->count[i] < 0 || end->count[i] < 0)
+      sum->count[i] = -1;
+    else
+      sum->count[i] += end->count[i] - start->count[i];
+}
+
+/* Hash table health counters, compiled in with -DHTSTATS=1. probes[n]
+ * counts the upserts that looked at n slots. An upsert either finds the
+ * whole name in shortname or has to compare the full names, which may
+ * turn out to differ. */
+#if HTSTATS
+struct htstats {
+  int64_t upserts, probes[PROBEMAX + 1], shorthits, fullcompares, fullhits;
+};
+#define HTSTAT(x) x
+#else
+#define HTSTAT(x)
+#endif
+
+/* The buffer that a thread is parsing, so that errors can be located: the
+ * mapping of a text file, where lines can be counted from start, a buffer of
+ * a pipe or gzip stream at offset in the decompressed stream, or a c12z block
+ * that was at offset in its file before decompression. */
+enum { SOURCEFILE, SOURCESTREAM, SOURCEBLOCK };
+
+struct source {
+  const char *path, *start, *end;
+  int64_t offset;
+  int kind;
+};
+
+struct threaddata {
+  struct record records[MAXRECORDS], *recordindex[1 << EXP];
+  int nrecords, nrehash;
+  uint64_t hashkey;
+  /* Names are copied here on first insert, terminated by ';' like in the
+   * input. Records never point into the input so it can be unmapped or handed
+   * back to its owner once it has been parsed. */
+  struct names {
+    char data[MAXRECORDS * (NAMEMAX + 1)], *end;
+  } names;
+  struct work *work;
+  int nwork, *nextwork;
+  struct stream *stream;
+  char *zbuf;
+  struct colagg **col;
+  struct approx *approx;
+  double *sumsq;
+  struct record *columns;
+  int spill;
+  FILE *spillfile;
+#if HTSTATS
+  struct htstats ht;
+#endif
+  struct sample parse;
+  struct span *spans;
+  int nspans;
+  int64_t nchunks, nbytes, nrows, busy, finish;
+  int64_t window, lastwindow;
+  struct source src;
+  int fixed;
+  /* parseschema copies names that are not followed by ';' here, from
+   * keyfield in the input. */
+  char key[NAMEMAX + 1];
+  const char *keyfield;
+  uint32_t spare;
+  pthread_t thread;
+} threaddata[NTHREAD];
+
+int recordnameasc(const void *a_, const void *b_) {
+  const struct record *a = a_, *b = b_;
+  int alen = namelen(a), blen = namelen(b);
+  int cmp = memcmp(a->fullname, b->fullname, alen < blen ? alen : blen);
+  return cmp + !cmp * (alen < blen ? -1 : 1);
+}
+
+/* From https://nullprogram.com/blog/2022/08/08/ */
+int ht_lookup(uint64_t hash, int exp, int idx) {
+  uint32_t mask = ((uint32_t)1 << exp) - 1;
+  uint32_t step = (hash >> (64 - exp)) | 1;
+  return (idx + step) & mask;
+}
+
+/* The hash is a polynomial like in the earlier versions but the multiplier
+ * is a random odd key instead of 111, so names that collide cannot be crafted
+ * in advance. If a probe sequence still gets longer than PROBEMAX, which at
+ * our load factor does not happen by chance, upsert rehashes the table of
+ * that thread with a new key. */
+void hashupdate(uint64_t *h, uint64_t key, char c) {
+  *h = key * *h + (uint64_t)c;
+}
+uint64_t hashsz(uint64_t key, const char *s, int size) {
+  uint64_t h = 0;
+  while (size--)
+    hashupdate(&h, key, *s++);
+  return h;
+}
+
+/* SplitMix64 finalizer */
+uint64_t mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+  return x ^ (x >> 31);
+}
+
+/* Make room for one more element in an array of n elements. */
+void *grow(void *p, int n, size_t size) {
+  if (!(n & (n - 1)))
+    assert(p = realloc(p, 2 * (n + 1) * size));
+  return p;
+}
+
+void rehash(struct threaddata *t) {
+  struct record *r;
+  uint64_t hash;
+  int i;
+
+  t->hashkey = mix(t->hashkey + ++t->nrehash) | 1;
+  if (t->nrehash == REHASHMAX)
+    warnx("thread %d: too many long probe sequences, giving up rehashing",
+          (int)(t - threaddata));
+  memset(t->recordindex, 0, sizeof(t->recordindex));
+  for (r = t->records; r < t->records + t->nrecords; r++) {
+    i = hash = hashsz(t->hashkey, r->fullname, namelen(r));
+    do
+      i = ht_lookup(hash, EXP, i);
+    while (t->recordindex[i]);
+    t->recordindex[i] = r;
+  }
+}
+
+/* Values are exact integers in units of 10^-scale, set with -scale, which is
+ * also the number of decimals printed. The default of 1 is the shape that
+ * parsefixed reads. Values may have at most scale decimals and 9 digits in
+ * all, so that min and max fit in 32 bits. */
+struct values {
+  int scale;
+  double unit;
+} values = {1, 10};
+
+const int64_t tens[] = {1,      10,      100,      1000,     10000,
+                        100000, 1000000, 10000000, 100000000};
+
+void scaleoption(const char *arg) {
+  char *end;
+  long n = strtol(arg, &end, 10);
+
+  if (*end || n < 0 || n >= nelem(tens))
+    errx(-1, "bad scale %s, want 0 to %d decimals", arg, (int)nelem(tens) - 1);
+  values.scale = n;
+  values.unit = tens[n];
+}
+
+/* printvalues prints min/mean/max of r after the separator sep. */
+void printvalues(const struct record *r, char sep) {
+  printf("%c%.*f/%.*f/%.*f", sep, values.scale, (double)r->min / values.unit,
+         values.scale, (double)r->total / (values.unit * (double)r->num),
+         values.scale, (double)r->max / values.unit);
+}
+
+/* -delimiter C, -key N and -values N[,N...] describe other line formats: the
+ * fields of a line are separated by C, the station name is field N, counting
+ * from 1, and every value field is aggregated on its own. Fields past the
+ * last one that is used are skipped. Anything but the default of
+ * -delimiter ';' -key 1 -values 2 is read by parseschema. Names must not
+ * contain ';', which terminates them in the tables. */
+#define SCHEMAMAX 8
+#define SCHEMACOLUMNS 64
+
+struct schema {
+  int on, key, nvalues, ncolumns;
+  char delimiter;
+  int values[SCHEMAMAX];
+  /* field[i] is -1 if field i is the name, 1 + j if it is value j and 0 if
+   * it is skipped. */
+  signed char field[SCHEMACOLUMNS + 1];
+} schema = {0, 1, 1, 2, ';', {2}};
+
+void delimiteroption(const char *arg) {
+  const char *c = !strcmp(arg, "\\t") ? "\t" : arg;
+
+  if (strlen(c) != 1 || strchr("\n+-.0123456789", *c))
+    errx(-1, "bad delimiter %s, want a byte that is not part of values", arg);
+  schema.delimiter = *c;
+}
+
+void keyoption(const char *arg) {
+  char *end;
+  long n = strtol(arg, &end, 10);
+
+  if (*end || n < 1 || n > SCHEMACOLUMNS)
+    errx(-1, "bad key column %s, want 1 to %d", arg, SCHEMACOLUMNS);
+  schema.key = n;
+}
+
+void valuesoption(const char *arg) {
+  const char *p;
+  char *end;
+  long n;
+
+  for (schema.nvalues = 0, p = arg;; p = end + 1) {
+    n = strtol(p, &end, 10);
+    if (end == p || (*end && *end != ',') || n < 1 || n > SCHEMACOLUMNS)
+      errx(-1, "bad value columns %s, want 1 to %d separated by ','", arg,
+           SCHEMACOLUMNS);
+    if (schema.nvalues == SCHEMAMAX)
+      errx(-1, "more than %d value columns", SCHEMAMAX);
+    schema.values[schema.nvalues++] = n;
+    if (!*end)
+      break;
+  }
+}
+
+/* schemastart checks the columns and turns the schema on if it is not the
+ * default one. Values after the first are kept in t->columns. */
+void schemastart(void) {
+  struct threaddata *t;
+  int i, c;
+
+  schema.field[schema.key] = -1;
+  schema.ncolumns = schema.key;
+  for (i = 0; i < schema.nvalues; i++) {
+    if (schema.field[c = schema.values[i]])
+      errx(-1, "column %d is used twice", c);
+    schema.field[c] = i + 1;
+    if (c > schema.ncolumns)
+      schema.ncolumns = c;
+  }
+  schema.on = schema.delimiter != ';' || schema.key != 1 ||
+              schema.nvalues != 1 || schema.values[0] != 2;
+  for (t = threaddata; schema.nvalues > 1 && t < endof(threaddata); t++)
+    assert(t->columns = calloc(MAXRECORDS * (schema.nvalues - 1),
+                               sizeof(*t->columns)));
+}
+
+/* valuerecord returns the record of value j > 0 for the record r of t. */
+struct record *valuerecord(struct threaddata *t, const struct record *r,
+                           int j) {
+  return t->columns + (r - t->records) * (schema.nvalues - 1) + j - 1;
+}
+
+/* Malformed input is found by the parsers at little cost: parsenum stops at
+ * the first byte that does not fit a value, a line without ';' runs into the
+ * next one and gives a name with a newline, which namealloc rejects along
+ * with names that are too long or not UTF-8, and every buffer is checked to
+ * end in a line with a ';' so that the name loops cannot run off its end.
+ * Only then does badinput go back to the start of the line, check it with
+ * checkline and, for text files, count the lines before it. -validate runs
+ * checkline on every line instead of parsing. */
+int timestamps;
+
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+/* swarhas is nonzero if a byte of x is c. */
+uint64_t swarhas(uint64_t x, char c) {
+  x ^= ONES * (uint8_t)c;
+  return (x - ONES) & ~x & HIGHS;
+}
+
+/* utf8len returns the size of the UTF-8 sequence at p, or 0 if it is not
+ * valid. Overlong encodings, surrogates and code points past U+10FFFF are
+ * not. */
+int utf8len(const char *p, const char *end) {
+  const uint8_t *u = (const uint8_t *)p;
+  int n, i, lo = 0x80, hi = 0xbf;
+
+  if (u[0] < 0x80)
+    return 1;
+  if (u[0] < 0xc2 || u[0] > 0xf4)
+    return 0;
+  n = u[0] < 0xe0 ? 2 : u[0] < 0xf0 ? 3 : 4;
+  if (u[0] == 0xe0)
+    lo = 0xa0;
+  else if (u[0] == 0xed)
+    hi = 0x9f;
+  else if (u[0] == 0xf0)
+    lo = 0x90;
+  else if (u[0] == 0xf4)
+    hi = 0x8f;
+  if (end - p < n)
+    return 0;
+  for (i = 1; i < n; i++, lo = 0x80, hi = 0xbf)
+    if (u[i] < lo || u[i] > hi)
+      return 0;
+  return n;
+}
+
+int utf8valid(const char *p, int size) {
+  const char *end = p + size;
+  int n;
+
+  for (; p < end; p += n)
+    if (!(n = utf8len(p, end)))
+      return 0;
+  return 1;
+}
+
+/* checkname checks the station name at *pp, which ends at the delimiter, or
+ * also at a newline if last, and moves *pp to its end. Names are scanned 8
+ * bytes at a time while they are ASCII. */
+const char *checkname(const char **pp, const char *end, const char **at,
+                      int last) {
+  const char *p = *pp, *name = p;
+  uint64_t x;
+  int n;
+
+  for (;;) {
+    if (end - p >= 8) {
+      memmove(&x, p, 8);
+      if (!(swarhas(x, schema.delimiter) | swarhas(x, ';') |
+            swarhas(x, '\n') | (x & HIGHS))) {
+        p += 8;
+        continue;
+      }
+    }
+    *at = p;
+    if (p == end)
+      return "missing newline at end of input";
+    if (*p == schema.delimiter || (*p == '\n' && last))
+      break;
+    if (*p == '\n')
+      return schema.on ? "too few fields" : "missing ';'";
+    if (*p == ';')
+      return "station name contains ';'";
+    if (!(n = utf8len(p, end)))
+      return "station name is not UTF-8";
+    p += n;
+  }
+  if (p == name)
+    return "empty station name";
+  if (p - name > NAMEMAX) {
+    *at = name + NAMEMAX;
+    return "station name longer than 100 bytes";
+  }
+  *pp = p;
+  return 0;
+}
+
+/* checkvalue checks the value at *pp and moves *pp to its end. */
+const char *checkvalue(const char **pp, const char *end, const char **at) {
+  const char *p = *pp;
+  int n;
+
+  p += p < end && (*p == '-' || *p == '+');
+  for (n = 0; *at = p, p < end && *p >= '0' && *p <= '9'; p++)
+    if (++n > 9 - values.scale)
+      return "too many digits for -scale";
+  if (!n)
+    return "expected a digit";
+  if (p < end && *p == '.' && values.scale) {
+    for (n = 0, p++; *at = p, p < end && *p >= '0' && *p <= '9'; p++)
+      if (++n > values.scale)
+        return "more decimals than -scale";
+    if (!n)
+      return "expected a digit";
+  }
+  *pp = p;
+  return 0;
+}
+
+/* checkfields is checkline for -delimiter, -key and -values. */
+const char *checkfields(const char *p, const char *end, const char **at) {
+  const char *why;
+  int i, field;
+
+  for (i = 1;; i++) {
+    field = i <= schema.ncolumns ? schema.field[i] : 0;
+    if (field < 0 && (why = checkname(&p, end, at, i >= schema.ncolumns)))
+      return why;
+    if (field > 0 && (why = checkvalue(&p, end, at)))
+      return why;
+    for (; !field && p < end && *p != schema.delimiter && *p != '\n'; p++)
+      ;
+    *at = p;
+    if (p == end)
+      return "missing newline at end of input";
+    if (*p == '\n')
+      return i < schema.ncolumns ? "too few fields" : 0;
+    if (*p != schema.delimiter)
+      return *p == '.' && !values.scale ? "more decimals than -scale"
+                                        : "expected a delimiter or newline";
+    p++;
+  }
+}
+
+/* checkline checks the line at p against the input format and returns why
+ * it is malformed, with *at at the offending byte, or 0 with *at at its
+ * newline. It never reads at or past end. */
+const char *checkline(const char *p, const char *end, const char **at) {
+  const char *why;
+  int n;
+
+  if (schema.on)
+    return checkfields(p, end, at);
+  if ((why = checkname(&p, end, at, 0)))
+    return why;
+  *at = ++p;
+  if (timestamps) {
+    for (n = 0; p < end && *p >= '0' && *p <= '9'; p++)
+      n++;
+    if (n != 10 || p == end || *p != ';')
+      return "timestamp is not 10 digits";
+    *at = ++p;
+  }
+  if ((why = checkvalue(&p, end, at)))
+    return why;
+  if (p == end)
+    return "missing newline at end of input";
+  if (*p != '\n')
+    return *p == '.' && !values.scale ? "more decimals than -scale"
+                                      : "expected a newline";
+  return 0;
+}
+
+int64_t countlines(const char *p, const char *end) {
+  int64_t n = 0;
+  while ((p = memchr(p, '\n', end - p)))
+    n++, p++;
+  return n;
+}
+
+/* sourceline prints where at is in src into buf. The line number counts from
+ * the start of the file, or of the block for c12z. */
+void sourceline(char *buf, size_t size, const struct source *src,
+                const char *at, int64_t line) {
+  if (src->kind == SOURCEFILE)
+    snprintf(buf, size, "%s:%lld: offset %lld", src->path, (long long)line,
+             (long long)(at - src->start));
+  else if (src->kind == SOURCESTREAM)
+    snprintf(buf, size, "%s: offset %lld", src->path,
+             (long long)(src->offset + (at - src->start)));
+  else
+    snprintf(buf, size, "%s: block at offset %lld, line %lld", src->path,
+             (long long)src->offset, (long long)line);
+}
+
+/* badinput reports the malformed line around p in src and exits. If the
+ * line turns out to be fine, why is the reason. */
+void badinput(const struct source *src, const char *p, const char *why) {
+  const char *line, *at = p, *reason;
+  char where[PATH_MAX + 64];
+
+  if (!src->path || p < src->start || p > src->end)
+    errx(-1, "%s", why);
+  for (line = p; line > src->start && line[-1] != '\n'; line--)
+    ;
+  if ((reason = checkline(line, src->end, &at)))
+    why = reason;
+  sourceline(where, sizeof(where), src, at, countlines(src->start, line) + 1);
+  errx(-1, "%s: %s", where, why);
+}
+
+/* lastline returns whether the buffer, which ends in a newline, ends in a
+ * line with a delimiter. */
+int lastline(const char *start, const char *end) {
+  const char *p;
+  for (p = end - 1; p > start && p[-1] != '\n'; p--)
+    if (*p == schema.delimiter)
+      return 1;
+  return *p == schema.delimiter;
+}
+
+void sourceset(struct source *src, const char *path, const char *start,
+               const char *end, int64_t offset, int kind) {
+  src->path = path;
+  src->start = start;
+  src->end = end;
+  src->offset = offset;
+  src->kind = kind;
+}
+
+/* -validate keeps the VALIDATEMAX first problems in input order, and counts
+ * all of them. */
+#define VALIDATEMAX 10
+
+struct problem {
+  struct source src;
+  const char *at, *why;
+  int64_t line;
+};
+
+struct validation {
+  int on, nproblems;
+  int64_t lines, bad;
+  struct problem problems[VALIDATEMAX + 1];
+  pthread_mutex_t mu;
+} validation = {0, 0, 0, 0, {{{0}}}, PTHREAD_MUTEX_INITIALIZER};
+
+int problemcmp(const struct problem *a, const struct problem *b) {
+  int64_t x = a->at - a->src.start, y = b->at - b->src.start;
+  int cmp = strcmp(a->src.path, b->src.path);
+
+  if (cmp)
+    return cmp;
+  if (a->src.offset != b->src.offset)
+    return a->src.offset < b->src.offset ? -1 : 1;
+  return (x > y) - (x < y);
+}
+
+/* problem records a malformed line for -validate, or reports it and exits.
+ * The line number is only needed for c12z blocks, whose buffer is reused. */
+void problem(const struct source *src, const char *at, const char *why,
+             int64_t line) {
+  struct problem *p;
+
+  if (!validation.on)
+    badinput(src, at, why);
+  assert(!pthread_mutex_lock(&validation.mu));
+  validation.bad++;
+  p = validation.problems + validation.nproblems;
+  p->src = *src;
+  p->at = at;
+  p->why = why;
+  p->line = line;
+  for (; p > validation.problems && problemcmp(p, p - 1) < 0; p--) {
+    struct problem tmp = *p;
+    p[0] = p[-1];
+    p[-1] = tmp;
+  }
+  if (validation.nproblems < VALIDATEMAX)
+    validation.nproblems++;
+  assert(!pthread_mutex_unlock(&validation.mu));
+}
+
+void namecheck(struct threaddata *t, const char *name, int size) {
+  if (!size || size > NAMEMAX || memchr(name, '\n', size) ||
+      memchr(name, ';', size) || !utf8valid(name, size))
+    badinput(&t->src, name == t->key ? t->keyfield : name,
+             "bad station name");
+}
+
+const char *namealloc(struct threaddata *t, const char *name, int size) {
+  struct names *names = &t->names;
+  char *ret;
+  namecheck(t, name, size);
+  if (!names->end)
+    names->end = names->data;
+  assert(endof(names->data) - names->end >= size + 1);
+  ret = names->end;
+  memmove(ret, name, size);
+  ret[size] = ';';
+  names->end += size + 1;
+  return ret;
+}
+
+/* When a thread table fills up, or holds -mem worth of stations, its records
+ * are sorted by name and appended to a temporary file of that thread as a
+ * run, and the table starts over. If anything was spilled, all tables are
+ * spilled at the end and the runs are merged by name straight into the
+ * output, so the number of stations is only limited by disk space. Files are
+ * unlinked as soon as they are created. A spilled record is its total, num,
+ * min and max, the size of its name and the name. */
+#define SPILLENTRYMAX (8 + 4 + 4 + 4 + 1 + NAMEMAX)
+
+struct run {
+  int fd;
+  int64_t start, end;
+};
+
+struct spill {
+  int limit, nruns;
+  const char *dir;
+  struct run *runs;
+  int64_t rows;
+  pthread_mutex_t mu;
+} spill = {MAXRECORDS, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+FILE *spillopen(void) {
+  char *path;
+  FILE *f;
+  int fd;
+
+  assert(path = malloc(strlen(spill.dir) + sizeof("/c12spillXXXXXX")));
+  sprintf(path, "%s/c12spillXXXXXX", spill.dir);
+  if ((fd = mkstemp(path)) < 0)
+    err(-1, "mkstemp %s", path);
+  unlink(path);
+  free(path);
+  if (!(f = fdopen(fd, "w+")))
+    err(-1, "fdopen");
+  return f;
+}
+
+void spillwrite(FILE *f, const struct record *r) {
+  char buf[SPILLENTRYMAX], *p = buf;
+  int size = namelen(r);
+
+  memmove(p, &r->total, 8);
+  memmove(p + 8, &r->num, 4);
+  memmove(p + 12, &r->min, 4);
+  memmove(p + 16, &r->max, 4);
+  p[20] = size;
+  memmove(p + 21, r->fullname, size);
+  if (fwrite(buf, 1, 21 + size, f) != 21 + size)
+    err(-1, "write spill file");
+}
+
+/* spilladd records the run that was written to f since start. */
+void spilladd(FILE *f, int64_t start) {
+  struct run *run;
+  int64_t end = ftello(f);
+
+  assert(!pthread_mutex_lock(&spill.mu));
+  spill.runs = grow(spill.runs, spill.nruns, sizeof(*spill.runs));
+  run = spill.runs + spill.nruns++;
+  run->fd = fileno(f);
+  run->start = start;
+  run->end = end;
+  assert(!pthread_mutex_unlock(&spill.mu));
+}
+
+void tablereset(struct threaddata *t) {
+  memset(t->records, 0, t->nrecords * sizeof(*t->records));
+  t->nrecords = 0;
+  t->names.end = t->names.data;
+  memset(t->recordindex, 0, sizeof(t->recordindex));
+}
+
+void spillrun(struct threaddata *t) {
+  struct record *r;
+  int64_t start;
+
+  if (!t->spillfile)
+    t->spillfile = spillopen();
+  start = ftello(t->spillfile);
+  qsort(t->records, t->nrecords, sizeof(*t->records), recordnameasc);
+  for (r = t->records; r < t->records + t->nrecords; r++)
+    spillwrite(t->spillfile, r);
+  spilladd(t->spillfile, start);
+  tablereset(t);
+}
+
+struct record *upsert(struct threaddata *t, const char *name, int size,
+                      uint64_t hash) {
+  int i = hash, comparesize = size < SHORTNAMESIZE ? size + 1 : SHORTNAMESIZE;
+  int probes = 0;
+  struct record **rp;
+
+  HTSTAT(t->ht.upserts++);
+  while (1) {
+    if (++probes > PROBEMAX && t->nrehash < REHASHMAX) {
+      rehash(t);
+      i = hash = hashsz(t->hashkey, name, size);
+      probes = 0;
+    }
+    i = ht_lookup(hash, EXP, i);
+    rp = t->recordindex + i;
+    if (!*rp) {
+      HTSTAT(t->ht.probes[probes < PROBEMAX ? probes : PROBEMAX]++);
+      if (t->spill && t->nrecords == spill.limit)
+        spillrun(t);
+      if (t->nrecords == nelem(t->records))
+        errx(-1, "more than %d stations in a table", (int)nelem(t->records));
+      *rp = t->records + t->nrecords++;
+      (*rp)->fullname = namealloc(t, name, size);
+      memmove((*rp)->shortname, name, comparesize);
+      return *rp;
+    } else if (!memcmp(name, (*rp)->shortname, comparesize)) {
+      const char *p, *q;
+      if (p = (*rp)->shortname + SHORTNAMESIZE - 1, *p == 0 || *p == ';') {
+        HTSTAT(t->ht.probes[probes < PROBEMAX ? probes : PROBEMAX]++);
+        HTSTAT(t->ht.shorthits++);
+        return *rp;
+      }
+      /* Both names are terminated by ';' so the loop cannot run off the end
+       * of either of them. */
+      HTSTAT(t->ht.fullcompares++);
+      for (p = (*rp)->fullname + SHORTNAMESIZE, q = name + SHORTNAMESIZE;
+           *p == *q && *p != ';'; p++, q++)
+        ;
+      if (*p == ';' && *q == ';') {
+        HTSTAT(t->ht.probes[probes < PROBEMAX ? probes : PROBEMAX]++);
+        HTSTAT(t->ht.fullhits++);
+        return *rp;
+      }
+    }
+  }
+}
+
+void printrecords(struct threaddata *t) {
+  struct record *r;
+  for (r = t->records; r < t->records + t->nrecords; r++) {
+    fwrite(r->fullname, 1, namelen(r), stdout);
+    putchar('\n');
+  }
+  putchar('\n');
+}
+
+struct record *upsertsz(struct threaddata *t, const char *s, int size) {
+  return upsert(t, s, size, hashsz(t->hashkey, s, size));
+}
+
+struct record *upsertstr(struct threaddata *t, char *s) {
+  return upsertsz(t, s, strchr(s, ';') - s);
+}
+
+void testupsert(void) {
+  struct record *abc, *def;
+  struct threaddata *t;
+  char data[] = "abc;def;abc;def;012;";
+  assert(t = calloc(sizeof(*t), 1));
+  t->hashkey = 111;
+
+  abc = upsertstr(t, data);
+  assert(t->nrecords == 1);
+  printrecords(t);
+  def = upsertstr(t, data + 4);
+  assert(t->nrecords == 2);
+  printrecords(t);
+  assert(upsertstr(t, data + 8) == abc);
+  assert(t->nrecords == 2);
+  printrecords(t);
+  assert(upsertstr(t, data + 12) == def);
+  assert(t->nrecords == 2);
+  printrecords(t);
+  upsertstr(t, data + 16);
+  assert(t->nrecords == 3);
+  printrecords(t);
+
+  /* Records must not depend on the input after insertion. */
+  memset(data, 'x', strlen(data));
+  assert(!memcmp(abc->fullname, "abc;", 4));
+  assert(!memcmp(def->fullname, "def;", 4));
+
+  free(t);
+}
+
+void updaterecord(struct record *r, int64_t total, int num, int64_t min,
+                  int64_t max) {
+  if (!r->num || min < r->min)
+    r->min = min;
+  if (!r->num || max > r->max)
+    r->max = max;
+  r->total += total;
+  r->num += num;
+}
+
+/* -engine shared parses into one table for all threads instead of a table
+ * per thread, so every station is stored once and nothing is merged at the
+ * end. The index is open addressing over record numbers. A thread takes a
+ * record with an atomic add, fills in the name and publishes the record with
+ * a compare-and-swap on an empty slot. If another thread got there first, it
+ * compares names with that record and keeps its own record for its next new
+ * station. Totals and counts are atomic adds, and min and max are updated by
+ * compare-and-swap only when they change. The index cannot rehash or grow, so
+ * all threads use one hash key and it is sized for SHAREDMAX stations at
+ * half load. */
+#ifndef SHAREDEXP
+#define SHAREDEXP 21
+#endif
+#define SHAREDMAX (1 << (SHAREDEXP - 1))
+
+struct shared {
+  int on, nrecords;
+  uint64_t hashkey;
+  uint32_t *index;
+  struct record *records;
+  char *names;
+} shared;
+
+void engineoption(const char *arg) {
+  if (strcmp(arg, "local") && strcmp(arg, "shared"))
+    errx(-1, "bad engine %s, want local or shared", arg);
+  shared.on = !strcmp(arg, "shared");
+}
+
+void sharedstart(uint64_t hashkey) {
+  shared.hashkey = hashkey;
+  assert(shared.index = calloc(1 << SHAREDEXP, sizeof(*shared.index)));
+  assert(shared.records = calloc(SHAREDMAX, sizeof(*shared.records)));
+  assert(shared.names = malloc((size_t)SHAREDMAX * (NAMEMAX + 1)));
+}
+
+/* recordis is the name comparison of upsert. */
+int recordis(const struct record *r, const char *name, int comparesize) {
+  const char *p, *q;
+
+  if (memcmp(name, r->shortname, comparesize))
+    return 0;
+  if (p = r->shortname + SHORTNAMESIZE - 1, *p == 0 || *p == ';')
+    return 1;
+  for (p = r->fullname + SHORTNAMESIZE, q = name + SHORTNAMESIZE;
+       *p == *q && *p != ';'; p++, q++)
+    ;
+  return *p == ';' && *q == ';';
+}
+
+struct record *sharedupsert(struct threaddata *t, const char *name, int size,
+                            uint64_t hash) {
+  int i = hash, comparesize = size < SHORTNAMESIZE ? size + 1 : SHORTNAMESIZE;
+  uint32_t id, *slot;
+  struct record *r;
+  char *p;
+
+  for (;;) {
+    i = ht_lookup(hash, SHAREDEXP, i);
+    slot = shared.index + i;
+    if (!(id = __atomic_load_n(slot, __ATOMIC_ACQUIRE))) {
+      if (!t->spare &&
+          (t->spare = __atomic_add_fetch(&shared.nrecords, 1,
+                                         __ATOMIC_RELAXED)) > SHAREDMAX)
+        errx(-1, "more than %d stations for -engine shared", SHAREDMAX);
+      namecheck(t, name, size);
+      r = shared.records + t->spare - 1;
+      p = shared.names + (size_t)(t->spare - 1) * (NAMEMAX + 1);
+      memmove(p, name, size);
+      p[size] = ';';
+      r->fullname = p;
+      memset(r->shortname, 0, SHORTNAMESIZE);
+      memmove(r->shortname, name, comparesize);
+      r->min = INT32_MAX;
+      r->max = INT32_MIN;
+      if (__atomic_compare_exchange_n(slot, &id, t->spare, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        t->spare = 0;
+        return r;
+      }
+    }
+    if (recordis(r = shared.records + id - 1, name, comparesize))
+      return r;
+  }
+}
+
+void sharedupdate(struct record *r, int64_t val) {
+  int32_t x = __atomic_load_n(&r->min, __ATOMIC_RELAXED);
+
+  while (val < x && !__atomic_compare_exchange_n(&r->min, &x, val, 1,
+                                                 __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED))
+    ;
+  x = __atomic_load_n(&r->max, __ATOMIC_RELAXED);
+  while (val > x && !__atomic_compare_exchange_n(&r->max, &x, val, 1,
+                                                 __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED))
+    ;
+  __atomic_fetch_add(&r->total, val, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&r->num, 1, __ATOMIC_RELAXED);
+}
+
+/* sharedcompact drops the records that threads took but did not publish,
+ * once all threads are done. */
+void sharedcompact(void) {
+  int i, n = 0;
+
+  for (i = 0; i < shared.nrecords && i < SHAREDMAX; i++)
+    if (shared.records[i].num)
+      shared.records[n++] = shared.records[i];
+  shared.nrecords = n;
+}
+
+/* parsefixed parses a value of the shape [-]d?d.d followed by stop, which
+ * is a newline or a delimiter, in tenths, from the 8 bytes at p. It drops
+ * the sign, puts a '0' in front of a single digit, and checks the digits
+ * with SWAR as in parseepoch. For anything else it returns NOTFIXED. */
+#define NOTFIXED INT64_MIN
+
+int64_t parsefixed(char **pp, char stop) {
+  uint64_t x, v;
+  int neg, short_;
+
+  memmove(&x, *pp, 8);
+  neg = (x & 0xff) == '-';
+  x >>= 8 * neg;
+  short_ = (x >> 8 & 0xff) == '.';
+  x = x << 8 * short_ | '0' * short_;
+  v = (x & 0xff00ffffUL) - 0x30003030UL;
+  if (((x ^ ((uint64_t)(uint8_t)stop << 32 | 0x2e0000)) & 0xff00ff0000UL) |
+      ((v | (v + 0x76007676UL)) & 0x80008080UL))
+    return NOTFIXED;
+  *pp += neg + 4 - short_;
+  v = (v & 0xff) * 100 + (v >> 8 & 0xff) * 10 + (v >> 24 & 0xff);
+  return neg ? -(int64_t)v : (int64_t)v;
+}
+
+/* parsescaled parses [+-]d...[.d...] in units of 10^-scale. It stops at the
+ * first byte that does not fit, such as a digit past the scale, so that the
+ * newline check of the caller fails. Without any digits it returns NOVALUE
+ * and leaves *pp where it was, which callers check along with the newline. */
+#define NOVALUE INT64_MIN
+
+int64_t parsescaled(char **pp) {
+  char *p = *pp;
+  int64_t val = 0, sign = 1;
+  int n = 0, decimals = 0;
+
+  if (*p == '-' || *p == '+')
+    sign = *p++ == '-' ? -1 : 1;
+  for (; *p >= '0' && *p <= '9' && n < 9 - values.scale; p++, n++)
+    val = 10 * val + (*p - '0');
+  if (n && *p == '.' && p[1] >= '0' && p[1] <= '9' && values.scale)
+    for (p++; *p >= '0' && *p <= '9' && decimals < values.scale; p++)
+      val = 10 * val + (*p - '0'), decimals++;
+  if (!n)
+    return NOVALUE;
+  *pp = p;
+  return sign * val * tens[values.scale - decimals];
+}
+
+/* parsenum reads values that end at stop with parsefixed until a value in
+ * the buffer does not have its shape, and with parsescaled from then on.
+ * parselines resets t->fixed for every buffer. */
+int64_t parsenum(struct threaddata *t, char **pp, char stop) {
+  int64_t val;
+
+  if (t->fixed) {
+    if (t->src.end - *pp >= 8 && (val = parsefixed(pp, stop)) != NOTFIXED)
+      return val;
+    t->fixed = 0;
+  }
+  return parsescaled(pp);
+}
+
+void failf(int *failcount, char *fmt, ...) {
+  va_list ap;
+  fprintf(stderr, "fail: ");
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  *failcount += 1;
+}
+
+/* Every value is parsed with parsefixed enabled and not, which must agree.
+ * Values that parsescaled stops early on are bad input for the caller, and
+ * values without digits are NOVALUE and not consumed. */
+void testparsenum(void) {
+  int failed = 0, fixed;
+  struct threaddata *td;
+  char buf[16];
+  struct {
+    char *in;
+    int scale;
+    int64_t out;
+    int off;
+  } * t, tests[] = {
+             {"12.3\n", 1, 123, 4},  {"-12.3\n", 1, -123, 5},
+             {"1.2\n", 1, 12, 3},    {"-1.2\n", 1, -12, 4},
+             {"0.0\n", 1, 0, 3},     {"123.4\n", 1, 1234, 5},
+             {"+1.5\n", 1, 15, 4},   {"7\n", 1, 70, 1},
+             {"-99999999.9\n", 1, -999999999, 11},
+             {"1.23\n", 1, 12, 3},   {"1.25\n", 2, 125, 4},
+             {"-0.5\n", 2, -50, 4},  {"12\n", 2, 1200, 2},
+             {"42\n", 0, 42, 2},     {"4.2\n", 0, 4, 1},
+             {"\n", 1, NOVALUE, 0}, {"-\n", 1, NOVALUE, 0},
+             {"+\n", 1, NOVALUE, 0}, {".5\n", 1, NOVALUE, 0},
+             {"-.5\n", 2, NOVALUE, 0},
+         };
+
+  assert(td = calloc(1, sizeof(*td)));
+  sourceset(&td->src, "test", buf, endof(buf), 0, SOURCEFILE);
+  for (t = tests; t < endof(tests); t++) {
+    int f = 0;
+    values.scale = t->scale;
+    for (fixed = 0; fixed < 2; fixed++) {
+      char *p = buf;
+      int64_t actual;
+      int off;
+      memset(buf, 0, sizeof(buf));
+      strcpy(buf, t->in);
+      td->fixed = fixed && t->scale == 1;
+      actual = parsenum(td, &p, '\n');
+      off = p - buf;
+      if (t->out != actual)
+        failf(&f, "%.*s: expected %lld, got %lld", t->off, t->in,
+              (long long)t->out, (long long)actual);
+      if (t->off != off)
+        failf(&f, "%.*s: expected pointer advanced by %d, got %d", t->off,
+              t->in, t->off, off);
+    }
+    failed += !!f;
+  }
+  values.scale = 1;
+  free(td);
+  if (failed)
+    warnx("testparsenum: %d/%ld tests failed", failed, t - tests);
+  else
+    warnx("testparsenum: %ld tests ok", t - tests);
+}
+
+/* checkline on good lines, where at is their newline, and on one of each
+ * kind of bad line. */
+void testcheckline(void) {
+  struct {
+    char *in, *why;
+    int at;
+  } * t, tests[] = {
+             {"abc;1.2\n", 0, 7},
+             {"abc;-12.3\n", 0, 9},
+             {"Z\xc3\xbcrich;0.0\n", 0, 11},
+             {"a name longer than eight bytes;99.9\n", 0, 35},
+             {"abc 1.2\n", "missing ';'", 7},
+             {";1.2\n", "empty station name", 0},
+             {"abc;1x.2\n", "expected a newline", 5},
+             {"abc;+123.4\n", 0, 10},
+             {"abc;123456789.0\n", "too many digits for -scale", 12},
+             {"abc;1.\n", "expected a digit", 6},
+             {"abc;-.5\n", "expected a digit", 5},
+             {"abc;1.23\n", "more decimals than -scale", 7},
+             {"abc;1.2.3\n", "expected a newline", 7},
+             {"abc;1.2", "missing newline at end of input", 7},
+             {"ab\xc3;1.0\n", "station name is not UTF-8", 2},
+             {"\xed\xa0\x80;1.0\n", "station name is not UTF-8", 0},
+             {"\xc0\xafx;1.0\n", "station name is not UTF-8", 0},
+             {"abc;", "expected a digit", 4},
+         };
+  const char *at, *why;
+  int f = 0;
+
+  for (t = tests; t < endof(tests); t++) {
+    why = checkline(t->in, t->in + strlen(t->in), &at);
+    if (why != t->why && (!why || !t->why || strcmp(why, t->why)))
+      failf(&f, "checkline(%s): got %s, want %s", t->in, why ? why : "ok",
+            t->why ? t->why : "ok");
+    else if (at - t->in != t->at)
+      failf(&f, "checkline(%s): at %d, want %d", t->in, (int)(at - t->in),
+            t->at);
+  }
+  if (f)
+    warnx("testcheckline: %d/%d tests failed", f, (int)nelem(tests));
+  else
+    warnx("testcheckline: %d tests ok", (int)nelem(tests));
+}
+
+/* With a key of 1 the hash is the sum of the characters so all permutations
+ * of a name collide. upsert must notice and rehash. */
+void testrehash(void) {
+  struct threaddata *t;
+  struct record *r[720];
+  char name[] = "abcdef;", *p, *q;
+  int i, j, n = 0, f = 0;
+
+  assert(t = calloc(sizeof(*t), 1));
+  t->hashkey = 1;
+  for (i = 0; i < nelem(r); i++) {
+    r[i] = upsertstr(t, name);
+    /* Advance to the next permutation in lexicographic order. */
+    for (p = name + 4; p >= name && p[0] > p[1]; p--)
+      ;
+    if (p < name)
+      break;
+    for (q = name + 5; *q < *p; q--)
+      ;
+    j = *p, *p = *q, *q = j;
+    for (p++, q = name + 5; p < q; p++, q--)
+      j = *p, *p = *q, *q = j;
+  }
+  n = i + 1;
+  if (n != nelem(r))
+    failf(&f, "expected %d permutations, got %d", (int)nelem(r), n);
+  if (t->nrecords != n)
+    failf(&f, "expected %d records, got %d", n, t->nrecords);
+  if (!t->nrehash)
+    failf(&f, "expected a rehash");
+  memmove(name, "abcdef;", 7);
+  if (upsertstr(t, name) != r[0] || t->nrecords != n)
+    failf(&f, "lookup after rehash failed");
+  if (f)
+    warnx("testrehash: failed");
+  else
+    warnx("testrehash: ok after %d rehashes", t->nrehash);
+  free(t);
+}
+
+/* -stations FILE and -exclude FILE. For -stations, a Bloom filter over the
+ * names in FILE rejects the rows of most other stations before upsert and
+ * parsenum run. It uses a fixed hash key, unlike the tables, so all threads
+ * share it, and sets 4 bits in a single 64-bit word per name so a test is
+ * one load. The few false positives are aggregated and dropped when
+ * printing, by an exact test against a hash set of the names. An exclude
+ * list lets most rows through, where a prefilter would only cost time, so
+ * -exclude only uses the exact test when printing. */
+#define FILTERKEY 0x9e3779b97f4a7c15UL
+
+struct filter {
+  int on, exclude, exp;
+  uint64_t *bloom, bloommask;
+  const char **set;
+} filter;
+
+uint64_t bloombits(uint64_t h) {
+  return (uint64_t)1 << (h & 63) | (uint64_t)1 << (h >> 6 & 63) |
+         (uint64_t)1 << (h >> 12 & 63) | (uint64_t)1 << (h >> 18 & 63);
+}
+
+int bloomtest(uint64_t h) {
+  uint64_t bits = bloombits(h);
+  return (filter.bloom[h >> 32 & filter.bloommask] & bits) == bits;
+}
+
+/* setfind returns a pointer to the slot of name in set, a table of 1 << exp
+ * names terminated by ';', which is empty if name is not in the set. */
+const char **setfind(const char **set, int exp, const char *name, int size,
+                     uint64_t h) {
+  const char **sp, *s;
+  int i = h, j;
+
+  while (1) {
+    i = ht_lookup(h, exp, i);
+    if (!*(sp = set + i))
+      return sp;
+    for (s = *sp, j = 0; j < size && s[j] == name[j]; j++)
+      ;
+    if (j == size && s[j] == ';')
+      return sp;
+  }
+}
+
+/* filterkeep is the exact test used for the output. */
+int filterkeep(const char *name, int size) {
+  int found;
+  if (!filter.on)
+    return 1;
+  found = !!*setfind(filter.set, filter.exp, name, size,
+                      mix(hashsz(FILTERKEY, name, size)));
+  return found != filter.exclude;
+}
+
+/* readall returns the contents of path in a new buffer and their end in
+ * *end. A missing newline at the end is added. */
+char *readall(const char *path, char **end) {
+  struct stat st;
+  char *data, *p;
+  ssize_t nread;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    err(-1, "open %s", path);
+  if (fstat(fd, &st))
+    err(-1, "fstat %s", path);
+  assert(data = malloc(st.st_size + 1));
+  for (p = data; p < data + st.st_size; p += nread)
+    if ((nread = read(fd, p, data + st.st_size - p)) <= 0)
+      err(-1, "read %s", path);
+  close(fd);
+  *end = data + st.st_size;
+  if (*end > data && (*end)[-1] != '\n')
+    *(*end)++ = '\n';
+  return data;
+}
+
+void filterload(const char *path, int exclude) {
+  char *data, *p, *q, *end;
+  uint64_t h;
+  int n, words;
+
+  if (filter.on)
+    errx(-1, "-stations and -exclude cannot be combined");
+  data = readall(path, &end);
+
+  for (n = 0, p = data; p < end; p++)
+    n += *p == '\n';
+  for (filter.exp = 4; 1 << filter.exp < 2 * n; filter.exp++)
+    ;
+  for (words = 1; words < n / 4; words *= 2)
+    ;
+  assert(filter.set = calloc(1 << filter.exp, sizeof(*filter.set)));
+  assert(filter.bloom = calloc(words, sizeof(*filter.bloom)));
+  filter.bloommask = words - 1;
+  filter.exclude = exclude;
+  filter.on = 1;
+
+  for (p = data; p < end; p = q + 1) {
+    q = memchr(p, '\n', end - p);
+    *q = ';';
+    if (q == p)
+      continue;
+    if (q - p > NAMEMAX)
+      errx(-1, "%s: station name longer than %d bytes", path, NAMEMAX);
+    h = mix(hashsz(FILTERKEY, p, q - p));
+    filter.bloom[h >> 32 & filter.bloommask] |= bloombits(h);
+    *setfind(filter.set, filter.exp, p, q - p, h) = p;
+  }
+}
+
+/* parsefiltered is parselines with the -stations prefilter. The hash for the
+ * table is only computed for rows that pass. */
+KERNEL char *parsefiltered(struct threaddata *t, char *line, char *end) {
+  struct record *r;
+
+  while (line < end) {
+    char *p = line;
+    int64_t val;
+    uint64_t h = 0;
+    while (*p != ';')
+      hashupdate(&h, FILTERKEY, *p++);
+    if (!bloomtest(mix(h))) {
+      while (*p != '\n')
+        p++;
+      line = p + 1;
+      continue;
+    }
+    r = upsert(t, line, p - line, hashsz(t->hashkey, line, p - line));
+    p++;
+
+    val = parsenum(t, &p, '\n');
+    updaterecord(r, val, 1, val, val);
+    if (*p != '\n' || val == NOVALUE)
+      badinput(&t->src, p, "expected a newline");
+    line = p + 1; /* consume newline */
+  }
+
+  return line;
+}
+
+/* -window SECONDS reads rows of the form name;timestamp;value, where the
+ * timestamp is a 10-digit Unix time in seconds as written by gendata -time,
+ * and aggregates the stations of each tumbling window of SECONDS separately.
+ * A thread aggregates into its own table as usual and merges it into the
+ * table of the window when the window changes and at the end of every work
+ * item. Timestamps must not decrease through the input, so once all work
+ * items up to some item are done, the windows before the last window of that
+ * item are complete. They are printed and freed right away, which bounds
+ * memory by the number of windows that are still open. */
+struct window {
+  int64_t id;
+  struct threaddata *t;
+  struct window *next;
+};
+
+struct windows {
+  int64_t size, closed, rows, *last;
+  struct window *open;
+  char *done;
+  int ndone;
+  pthread_mutex_t mu;
+} windows = {0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+/* parseepoch parses the 10-digit timestamp at p, which must be followed by
+ * ';' before end, or returns -1. The first 8 digits are loaded as one
+ * little-endian word and combined pairwise into 2, 4 and 8-digit numbers,
+ * which takes 3 multiplies instead of 8. A byte that is not a digit either
+ * underflows or overflows into its top bit. Fewer than 11 bytes before end
+ * cannot hold a timestamp and its ';', and are not read at all. */
+int64_t parseepoch(const char *p, const char *end) {
+  uint64_t x;
+
+  if (end - p < 11)
+    return -1;
+  memmove(&x, p, sizeof(x));
+  x -= 0x3030303030303030UL;
+  if ((x | (x + 0x7676767676767676UL)) & 0x8080808080808080UL ||
+      (unsigned)(p[8] - '0') > 9 || (unsigned)(p[9] - '0') > 9 || p[10] != ';')
+    return -1;
+  x = (x * 10 + (x >> 8)) & 0x00ff00ff00ff00ffUL;
+  x = (x * 100 + (x >> 16)) & 0x0000ffff0000ffffUL;
+  x = (x * 10000 + (x >> 32)) & 0xffffffffUL;
+  return x * 100 + (p[8] - '0') * 10 + (p[9] - '0');
+}
+
+/* The short timestamps end the input, and are copied to a buffer of their
+ * exact size so that reading past it shows up under a sanitizer. */
+void testparseepoch(void) {
+  char *good[] = {"1700000000;", "0000000000;", "9999999999;", "1234567890;"};
+  char *bad[] = {"170000000;;", "17000000x0;", "1700000000:", "/700000000;",
+                 ":700000000;", "1700000\2000;", "170000000a;"};
+  char *short_[] = {"", "1", "1700", "170000000", "1700000000"};
+  char *buf;
+  int i, n, f = 0;
+
+  for (i = 0; i < nelem(good); i++)
+    if (parseepoch(good[i], good[i] + 11) != strtoll(good[i], 0, 10))
+      failf(&f, "parseepoch(%s) = %lld", good[i],
+            (long long)parseepoch(good[i], good[i] + 11));
+  for (i = 0; i < nelem(bad); i++)
+    if (parseepoch(bad[i], bad[i] + 11) != -1)
+      failf(&f, "parseepoch(%s) = %lld, want -1", bad[i],
+            (long long)parseepoch(bad[i], bad[i] + 11));
+  for (i = 0; i < nelem(short_); i++) {
+    n = strlen(short_[i]);
+    assert(buf = malloc(n + 1));
+    memmove(buf, short_[i], n);
+    if (parseepoch(buf, buf + n) != -1)
+      failf(&f, "parseepoch(%s) at end of input = %lld, want -1", short_[i],
+            (long long)parseepoch(buf, buf + n));
+    buf[n] = ';';
+    if (parseepoch(buf, buf + n + 1) != (n == 10 ? 1700000000 : -1))
+      failf(&f, "parseepoch(%s;) at end of input = %lld", short_[i],
+            (long long)parseepoch(buf, buf + n + 1));
+    free(buf);
+  }
+  if (f)
+    warnx("testparseepoch: %d tests failed", f);
+  else
+    warnx("testparseepoch: %d tests ok",
+          (int)(nelem(good) + nelem(bad) + 2 * nelem(short_)));
+}
+
+/* windowflush merges the table of t into its window and moves t on to window
+ * next. */
+void windowflush(struct threaddata *t, int64_t next) {
+  struct window **wp, *w;
+  struct record *r;
+
+  if (t->nrecords) {
+    assert(!pthread_mutex_lock(&windows.mu));
+    if (t->window < windows.closed)
+      errx(-1, "timestamps out of order: window %lld was already printed",
+           (long long)(t->window * windows.size));
+    for (wp = &windows.open; *wp && (*wp)->id < t->window; wp = &(*wp)->next)
+      ;
+    if (!*wp || (*wp)->id != t->window) {
+      assert(w = calloc(1, sizeof(*w)));
+      assert(w->t = calloc(1, sizeof(*w->t)));
+      w->t->hashkey = t->hashkey;
+      w->id = t->window;
+      w->next = *wp;
+      *wp = w;
+    }
+    for (r = t->records; r < t->records + t->nrecords; r++) {
+      updaterecord(upsertsz((*wp)->t, r->fullname, namelen(r)), r->total,
+                   r->num, r->min, r->max);
+      t->nrows += r->num;
+      windows.rows += r->num;
+    }
+    assert(!pthread_mutex_unlock(&windows.mu));
+    tablereset(t);
+  }
+  t->window = next;
+  if (next > t->lastwindow)
+    t->lastwindow = next;
+}
+
+/* parsewindowed is parselines for -window. */
+KERNEL char *parsewindowed(struct threaddata *t, char *line, char *end) {
+  struct record *r;
+  int64_t val, window;
+
+  while (line < end) {
+    char *p = line;
+    uint64_t hash = 0, key = t->hashkey;
+    while (*p != ';')
+      hashupdate(&hash, key, *p++);
+    if ((window = parseepoch(p + 1, t->src.end)) < 0)
+      badinput(&t->src, p + 1, "timestamp is not 10 digits");
+    window /= windows.size;
+    if (window != t->window)
+      windowflush(t, window);
+    r = upsert(t, line, p - line, hash);
+    p += 12;
+
+    val = parsenum(t, &p, '\n');
+    updaterecord(r, val, 1, val, val);
+    if (*p != '\n' || val == NOVALUE)
+      badinput(&t->src, p, "expected a newline");
+    line = p + 1; /* consume newline */
+  }
+
+  return line;
+}
+
+/* -approx K estimates the number of distinct stations and the aggregates of
+ * the K most frequent ones in memory that does not depend on the input. It
+ * uses the name hash that parselines computes anyway. All threads start with
+ * the same hash key and never rehash in this mode, so their hashes agree.
+ *
+ * The distinct count is a HyperLogLog sketch of 1 << HLLBITS registers, about
+ * 0.8% standard error. Frequent stations are tracked by Space-Saving with
+ * APPROXSIZE counters per thread: a station without a counter takes over the
+ * one with the fewest rows, and inherits that count as its error. A min-heap
+ * of the counters finds that one, and counters are found by name through a
+ * linear probing index. The aggregates of a counter cover the rows since it
+ * was taken over, and the true row count is at most that plus the error. */
+#ifndef APPROXSIZE
+#define APPROXSIZE 4096
+#endif
+#define HLLBITS 14
+
+struct counter {
+  struct record r;
+  uint64_t hash;
+  int64_t error;
+  int heap;
+  char name[NAMEMAX + 1];
+};
+
+struct approx {
+  uint8_t hll[1 << HLLBITS];
+  struct counter counters[APPROXSIZE], *heap[APPROXSIZE];
+  struct counter *index[2 * APPROXSIZE];
+  int ncounters;
+  int64_t rows;
+};
+
+int approxk;
+
+int64_t countof(const struct counter *c) { return c->r.num + c->error; }
+
+void counterswap(struct approx *a, int i, int j) {
+  struct counter *c = a->heap[i];
+  a->heap[i] = a->heap[j];
+  a->heap[j] = c;
+  a->heap[i]->heap = i;
+  a->heap[j]->heap = j;
+}
+
+/* countersift restores the heap after the count of heap[i] grew, and
+ * counterpush after a counter was added at the end. */
+void countersift(struct approx *a, int i) {
+  int child;
+  while ((child = 2 * i + 1) < a->ncounters) {
+    if (child + 1 < a->ncounters &&
+        countof(a->heap[child + 1]) < countof(a->heap[child]))
+      child++;
+    if (countof(a->heap[i]) <= countof(a->heap[child]))
+      break;
+    counterswap(a, i, child);
+    i = child;
+  }
+}
+
+void counterpush(struct approx *a, int i) {
+  for (; i && countof(a->heap[i]) < countof(a->heap[(i - 1) / 2]);
+       i = (i - 1) / 2)
+    counterswap(a, i, (i - 1) / 2);
+}
+
+/* counterfind returns the index slot of name, which is empty if name has no
+ * counter. */
+struct counter **counterfind(struct approx *a, const char *name, int size,
+                             uint64_t h) {
+  struct counter **cp;
+  int i = h & (nelem(a->index) - 1);
+
+  while (*(cp = a->index + i) &&
+         ((*cp)->hash != h || memcmp((*cp)->name, name, size) ||
+          (*cp)->name[size] != ';'))
+    i = (i + 1) & (nelem(a->index) - 1);
+  return cp;
+}
+
+/* counterunindex removes slot i from the index, moving later entries of the
+ * same probe run back so that lookups do not stop early. */
+void counterunindex(struct approx *a, int i) {
+  int j = i, home, mask = nelem(a->index) - 1;
+
+  a->index[i] = 0;
+  while (a->index[j = (j + 1) & mask]) {
+    home = a->index[j]->hash & mask;
+    if (j > i ? home <= i || home > j : home <= i && home > j) {
+      a->index[i] = a->index[j];
+      a->index[j] = 0;
+      i = j;
+    }
+  }
+}
+
+void approxupdate(struct approx *a, const char *name, int size, uint64_t h,
+                  int64_t val) {
+  struct counter **cp, *c;
+  uint64_t x = h << HLLBITS | (uint64_t)1 << (HLLBITS - 1);
+  int rank = __builtin_clzll(x) + 1, added = 0;
+
+  if (rank > a->hll[h >> (64 - HLLBITS)])
+    a->hll[h >> (64 - HLLBITS)] = rank;
+
+  if (!*(cp = counterfind(a, name, size, h))) {
+    if (a->ncounters < APPROXSIZE) {
+      c = a->counters + a->ncounters;
+      a->heap[c->heap = a->ncounters++] = c;
+      added = 1;
+    } else {
+      c = a->heap[0];
+      counterunindex(a, counterfind(a, c->name, namelen(&c->r), c->hash) -
+                            a->index);
+      c->error = countof(c);
+      cp = counterfind(a, name, size, h);
+    }
+    if (size > NAMEMAX)
+      errx(-1, "station name longer than %d bytes: %.*s", NAMEMAX, size, name);
+    memmove(c->name, name, size);
+    c->name[size] = ';';
+    c->r.fullname = c->name;
+    c->r.num = 0;
+    c->r.total = 0;
+    c->hash = h;
+    *cp = c;
+  }
+  c = *cp;
+  updaterecord(&c->r, val, 1, val, val);
+  a->rows++;
+  if (added)
+    counterpush(a, c->heap);
+  else
+    countersift(a, c->heap);
+}
+
+/* parseapprox is parselines for -approx. */
+KERNEL char *parseapprox(struct threaddata *t, char *line, char *end) {
+  while (line < end) {
+    char *p = line;
+    int64_t val;
+    int size;
+    uint64_t hash = 0, key = t->hashkey;
+    while (*p != ';')
+      hashupdate(&hash, key, *p++);
+    size = p++ - line;
+
+    val = parsenum(t, &p, '\n');
+    approxupdate(t->approx, line, size, mix(hash), val);
+    if (*p != '\n' || val == NOVALUE)
+      badinput(&t->src, p, "expected a newline");
+    line = p + 1; /* consume newline */
+  }
+
+  return line;
+}
+
+double hllestimate(const uint8_t *hll) {
+  double sum = 0, m = 1 << HLLBITS, e;
+  int i, zeros = 0;
+
+  for (i = 0; i < 1 << HLLBITS; i++) {
+    sum += ldexp(1, -hll[i]);
+    zeros += !hll[i];
+  }
+  e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (e <= 2.5 * m && zeros)
+    e = m * log(m / zeros);
+  return e;
+}
+
+/* countercmp orders counters by their inline names, which unlike r.fullname
+ * stay valid while qsort moves the counters. */
+int countercmp(const struct counter *x, const struct counter *y) {
+  int xlen = strchr(x->name, ';') - x->name;
+  int ylen = strchr(y->name, ';') - y->name;
+  int cmp = memcmp(x->name, y->name, xlen < ylen ? xlen : ylen);
+  return cmp ? cmp : xlen - ylen;
+}
+
+/* counternameasc is recordnameasc for counters, which may have equal names. */
+int counternameasc(const void *a, const void *b) {
+  return countercmp(*(struct counter **)a, *(struct counter **)b);
+}
+
+int countercountdesc(const void *a_, const void *b_) {
+  const struct counter *a = a_, *b = b_;
+  if (countof(a) != countof(b))
+    return countof(a) < countof(b) ? 1 : -1;
+  return countercmp(a, b);
+}
+
+/* approxmerge merges the sketches of all threads into a, and their counters
+ * into a new array, which it returns sorted by count. A station that a full
+ * thread has no counter for may have had as many rows there as the smallest
+ * counter of that thread, which is added to its error. */
+struct counter *approxmerge(struct approx *a, int *nmerged) {
+  struct counter **all, **c, **next, *merged, *m;
+  struct threaddata *t;
+  int64_t mins[NTHREAD], summin = 0;
+  int n = 0, i;
+
+  memset(a, 0, sizeof(*a));
+  for (t = threaddata; t < endof(threaddata); t++) {
+    for (i = 0; i < nelem(a->hll); i++)
+      if (t->approx->hll[i] > a->hll[i])
+        a->hll[i] = t->approx->hll[i];
+    a->rows += t->approx->rows;
+    n += t->approx->ncounters;
+    mins[t - threaddata] = t->approx->ncounters == APPROXSIZE
+                               ? countof(t->approx->heap[0])
+                               : 0;
+    summin += mins[t - threaddata];
+  }
+
+  assert(all = malloc((n + 1) * sizeof(*all)));
+  assert(merged = calloc(n + 1, sizeof(*merged)));
+  for (c = all, t = threaddata; t < endof(threaddata); t++)
+    for (i = 0; i < t->approx->ncounters; i++)
+      *c++ = t->approx->counters + i;
+  qsort(all, n, sizeof(*all), counternameasc);
+
+  for (m = merged, c = all; c < all + n; c = next, m++) {
+    *m = **c;
+    m->r.fullname = m->name;
+    m->r.num = 0;
+    m->r.total = 0;
+    m->error = summin;
+    for (next = c; next < all + n && !counternameasc(c, next); next++) {
+      updaterecord(&m->r, (*next)->r.total, (*next)->r.num, (*next)->r.min,
+                   (*next)->r.max);
+      for (t = threaddata; t < endof(threaddata); t++)
+        if (*next >= t->approx->counters &&
+            *next < t->approx->counters + APPROXSIZE)
+          m->error += (*next)->error - mins[t - threaddata];
+    }
+  }
+  free(all);
+  *nmerged = m - merged;
+  qsort(merged, *nmerged, sizeof(*merged), countercountdesc);
+  for (m = merged; m < merged + *nmerged; m++)
+    m->r.fullname = m->name;
+  return merged;
+}
+
+/* Feed a million distinct names and 10 heavy hitters with 1 in 8 rows each
+ * through one thread, and check the estimate and that every heavy hitter is
+ * reported with bounds that hold its true count. */
+void testapprox(void) {
+  struct threaddata *t;
+  char name[32], *p;
+  int64_t want = 1000000, i, est, heavy[10] = {0};
+  int f = 0;
+
+  assert(t = calloc(1, sizeof(*t)));
+  assert(t->approx = calloc(1, sizeof(*t->approx)));
+  t->hashkey = 111;
+  for (i = 0; i < want; i++) {
+    p = name + sprintf(name, "s%lld;1.0\n", (long long)i);
+    parseapprox(t, name, p);
+    if (i % 8 == 0) {
+      p = name + sprintf(name, "heavy%lld;-2.5\n", (long long)(i / 8 % 10));
+      parseapprox(t, name, p);
+      heavy[i / 8 % 10]++;
+    }
+  }
+  est = hllestimate(t->approx->hll);
+  want += nelem(heavy);
+  if (est < want * 0.97 || est > want * 1.03)
+    failf(&f, "estimated %lld stations, want %lld", (long long)est,
+          (long long)want);
+  for (i = 0; i < nelem(heavy); i++) {
+    struct counter *c;
+    int size = sprintf(name, "heavy%lld", (long long)i);
+    uint64_t h = mix(hashsz(111, name, size));
+    if (!(c = *counterfind(t->approx, name, size, h)))
+      failf(&f, "heavy hitter %s not found", name);
+    else if (c->r.num > heavy[i] || countof(c) < heavy[i] ||
+             c->r.max != -25)
+      failf(&f, "%s: %d to %lld rows, want %lld", name, c->r.num,
+            (long long)countof(c), (long long)heavy[i]);
+  }
+  if (f)
+    warnx("testapprox: failed");
+  else
+    warnx("testapprox: ok, estimated %lld of %lld stations", (long long)est,
+          (long long)want);
+  free(t->approx);
+  free(t);
+}
+
+/* -sample FRACTION parses a random FRACTION of the work items, taken in an
+ * order shuffled with -seed, so only those parts of the input are read. Row
+ * counts are scaled up by the share of input bytes that was parsed. The mean
+ * comes with a 95% confidence interval, which assumes that the rows of a
+ * station are spread over the input independently of their values; on
+ * clustered input it is too narrow. Minima and maxima are those of the
+ * sample. */
+struct sampling {
+  double fraction;
+  uint64_t seed;
+  int64_t bytes, sampledbytes;
+} sampling = {0, 1};
+
+void sampleoption(const char *arg) {
+  char *end;
+
+  sampling.fraction = strtod(arg, &end);
+  if (*end || !(sampling.fraction > 0 && sampling.fraction <= 1))
+    errx(-1, "bad fraction %s, want more than 0 and at most 1", arg);
+}
+
+/* parsesampled is parselines for -sample, which also needs the sum of
+ * squares of each station for the confidence interval of its mean. */
+KERNEL char *parsesampled(struct threaddata *t, char *line, char *end) {
+  struct record *r;
+
+  while (line < end) {
+    char *p = line;
+    int64_t val;
+    uint64_t hash = 0, key = t->hashkey;
+    while (*p != ';')
+      hashupdate(&hash, key, *p++);
+    r = upsert(t, line, p - line, hash);
+    p++;
+
+    val = parsenum(t, &p, '\n');
+    updaterecord(r, val, 1, val, val);
+    t->sumsq[r - t->records] += (double)val * val;
+    if (*p != '\n' || val == NOVALUE)
+      badinput(&t->src, p, "expected a newline");
+    line = p + 1; /* consume newline */
+  }
+
+  return line;
+}
+
+/* separators returns a mask with bit i set if p[i] is the delimiter or a
+ * newline, for the 64 bytes at p or those before end. Each 8 bytes are
+ * compared at once with SWAR, exactly rather than like swarhas, which may
+ * also flag the byte after a match, and the top bits of the bytes that match
+ * are gathered into 8 bits of the mask with a multiply. */
+uint64_t separators(const char *p, const char *end) {
+  uint64_t x, d, n, m = 0, low = ~HIGHS;
+  int i;
+
+  if (end - p < 64) {
+    for (i = 0; i < end - p; i++)
+      m |= (uint64_t)(p[i] == schema.delimiter || p[i] == '\n') << i;
+    return m;
+  }
+  for (i = 0; i < 64; i += 8) {
+    memmove(&x, p + i, 8);
+    d = x ^ ONES * (uint8_t)schema.delimiter;
+    n = x ^ ONES * '\n';
+    x = (~(((d & low) + low) | d) | ~(((n & low) + low) | n)) & HIGHS;
+    m |= ((x >> 7) * 0x0102040810204080UL) >> 56 << i;
+  }
+  return m;
+}
+
+/* The fields of the input from base are found through the separators mask
+ * of 64 bytes at a time. */
+struct fields {
+  const char *base, *end;
+  uint64_t bits;
+};
+
+/* nextsep returns the first delimiter or newline at or after p, or end. p
+ * must be at most 64 bytes past f->base. */
+const char *nextsep(struct fields *f, const char *p) {
+  uint64_t m;
+
+  while (p - f->base == 64 || !(m = f->bits >> (p - f->base))) {
+    if ((f->base += 64) >= f->end)
+      return f->end;
+    f->bits = separators(f->base, f->end);
+    p = p > f->base ? p : f->base;
+  }
+  return p + __builtin_ctzll(m);
+}
+
+/* parseschema is parselines for -delimiter, -key and -values. */
+KERNEL char *parseschema(struct threaddata *t, char *line, char *end) {
+  struct fields f;
+  struct record *r;
+  const char *p, *sep = line, *name = line;
+  int64_t val[SCHEMAMAX];
+  uint64_t hash;
+  int i, j, size = 0;
+
+  f.base = line;
+  f.end = t->src.end;
+  f.bits = separators(f.base, f.end);
+  while (line < end) {
+    for (i = 1, p = line;; i++, p = sep + 1) {
+      if ((sep = nextsep(&f, p)) == f.end)
+        badinput(&t->src, sep, "missing newline at end of input");
+      j = i <= schema.ncolumns ? schema.field[i] : 0;
+      if (j < 0) {
+        name = p;
+        size = sep - p;
+      } else if (j > 0) {
+        char *q = (char *)p;
+        val[j - 1] = parsenum(t, &q, *sep);
+        if (q != sep || val[j - 1] == NOVALUE)
+          badinput(&t->src, q, "expected a delimiter or newline");
+      }
+      if (*sep == '\n')
+        break;
+    }
+    if (i < schema.ncolumns)
+      badinput(&t->src, sep, "too few fields");
+    if (name[size] != ';') {
+      if (size > NAMEMAX)
+        badinput(&t->src, name, "bad station name");
+      for (hash = 0, j = 0; j < size; j++)
+        hashupdate(&hash, t->hashkey, t->key[j] = name[j]);
+      t->key[size] = ';';
+      t->keyfield = name;
+      name = t->key;
+    } else {
+      hash = hashsz(t->hashkey, name, size);
+    }
+    r = upsert(t, name, size, hash);
+    updaterecord(r, val[0], 1, val[0], val[0]);
+    for (j = 1; j < schema.nvalues; j++)
+      updaterecord(valuerecord(t, r, j), val[j], 1, val[j], val[j]);
+    line = (char *)sep + 1;
+  }
+
+  return line;
+}
+
+/* parseshared is parselines for -engine shared. Rows are counted here for
+ * -stats because the thread has no table to count them from. */
+KERNEL char *parseshared(struct threaddata *t, char *line, char *end) {
+  struct record *r;
+  int64_t rows = 0;
+
+  while (line < end) {
+    char *p = line;
+    int64_t val;
+    uint64_t hash = 0, key = shared.hashkey;
+    while (*p != ';')
+      hashupdate(&hash, key, *p++);
+    r = sharedupsert(t, line, p - line, hash);
+    p++;
+
+    val = parsenum(t, &p, '\n');
+    sharedupdate(r, val);
+    if (*p != '\n' || val == NOVALUE)
+      badinput(&t->src, p, "expected a newline");
+    line = p + 1; /* consume newline */
+    rows++;
+  }
+  t->nrows += rows;
+
+  return line;
+}
+
+/* validatelines is parselines for -validate. After a malformed line it goes
+ * on with the next one. */
+char *validatelines(struct threaddata *t, char *line, char *end) {
+  const char *at, *why;
+  int64_t lines = 0;
+
+  for (; line < end; lines++) {
+    if ((why = checkline(line, t->src.end, &at))) {
+      problem(&t->src, at, why, lines + 1);
+      if (!(at = memchr(at, '\n', t->src.end - at)))
+        at = t->src.end - 1;
+    }
+    line = (char *)at + 1;
+  }
+  __atomic_fetch_add(&validation.lines, lines, __ATOMIC_RELAXED);
+  return line;
+}
+
+/* parseplain is parselines for name;value rows without any of the options
+ * below. */
+KERNEL char *parseplain(struct threaddata *t, char *line, char *end) {
+  struct record *r;
+
+  while (line < end) {
+    char *p = line;
+    int64_t val;
+    uint64_t hash = 0, key = t->hashkey;
+    while (*p != ';')
+      hashupdate(&hash, key, *p++);
+    r = upsert(t, line, p - line, hash);
+    p++;
+
+    val = parsenum(t, &p, '\n');
+    updaterecord(r, val, 1, val, val);
+    if (*p != '\n' || val == NOVALUE)
+      badinput(&t->src, p, "expected a newline");
+    line = p + 1; /* consume newline */
+  }
+
+  return line;
+}
+
+/* Parse all lines that start before end. Lines must be complete: the last one
+ * may extend past end but it must be terminated by a newline. */
+KERNEL char *parselines(struct threaddata *t, char *line, char *end) {
+  t->fixed = values.scale == 1;
+  if (validation.on)
+    return validatelines(t, line, end);
+  if (schema.on)
+    return parseschema(t, line, end);
+  if (shared.on)
+    return parseshared(t, line, end);
+  if (approxk)
+    return parseapprox(t, line, end);
+  if (sampling.fraction)
+    return parsesampled(t, line, end);
+  if (windows.size)
+    return parsewindowed(t, line, end);
+  if (filter.on && !filter.exclude)
+    return parsefiltered(t, line, end);
+  return parseplain(t, line, end);
+}
+
+/* parseschema and checkfields with the name in the middle, the values out of
+ * order and a field to skip, at scale 2. */
+void testschema(void) {
+  struct schema saved = schema;
+  struct values savedvalues = values;
+  struct threaddata *t;
+  struct record *r;
+  char in[] = "1.5,x,Oslo,-2.0\n2,y,Oslo,4\n-3.25,z,Bern,0.5,extra\n";
+  char oslo[] = "Oslo;", bern[] = "Bern;";
+  struct {
+    char *in, *why;
+    int at;
+  } * c, tests[] = {
+             {"1.5,x,Oslo,-2.0\n", 0, 15},
+             {"1.5,x,a,1,more,fields\n", 0, 21},
+             {"1.5,x,Oslo\n", "too few fields", 10},
+             {"1.5,x,,1\n", "empty station name", 6},
+             {"1.5,x,a;b,1\n", "station name contains ';'", 7},
+             {"1.5x,x,a,1\n", "expected a delimiter or newline", 3},
+             {"1.555,x,a,1\n", "more decimals than -scale", 4},
+         };
+  const char *at, *why;
+  int f = 0;
+
+  delimiteroption(",");
+  keyoption("3");
+  valuesoption("4,1");
+  scaleoption("2");
+  schemastart();
+  assert(t = calloc(1, sizeof(*t)));
+  assert(t->columns = calloc(MAXRECORDS, sizeof(*t->columns)));
+  t->hashkey = 111;
+  sourceset(&t->src, "test", in, in + strlen(in), 0, SOURCEFILE);
+  parselines(t, in, in + strlen(in));
+  r = upsertstr(t, oslo);
+  if (t->nrecords != 2 || r->num != 2 || r->min != -200 || r->max != 400 ||
+      r->total != 200)
+    failf(&f, "parseschema: Oslo value 4 is wrong");
+  r = valuerecord(t, r, 1);
+  if (r->num != 2 || r->min != 150 || r->max != 200 || r->total != 350)
+    failf(&f, "parseschema: Oslo value 1 is wrong");
+  r = upsertstr(t, bern);
+  if (r->total != 50 || valuerecord(t, r, 1)->total != -325)
+    failf(&f, "parseschema: Bern is wrong");
+  for (c = tests; c < endof(tests); c++) {
+    why = checkline(c->in, c->in + strlen(c->in), &at);
+    if (why != c->why && (!why || !c->why || strcmp(why, c->why)))
+      failf(&f, "checkfields(%s): got %s, want %s", c->in, why ? why : "ok",
+            c->why ? c->why : "ok");
+    else if (at - c->in != c->at)
+      failf(&f, "checkfields(%s): at %d, want %d", c->in, (int)(at - c->in),
+            c->at);
+  }
+  free(t->columns);
+  free(t);
+  for (t = threaddata; t < endof(threaddata); t++) {
+    free(t->columns);
+    t->columns = 0;
+  }
+  schema = saved;
+  values = savedvalues;
+  if (f)
+    warnx("testschema: %d tests failed", f);
+  else
+    warnx("testschema: %d tests ok", 3 + (int)nelem(tests));
+}
+
+/* c12z is a block-compressed input format. After ZMAGIC, a file is a
+ * sequence of blocks, each with a header of two little-endian 32-bit words
+ * (uncompressed size, compressed size). Blocks hold at most CHUNKSIZE bytes
+ * of complete lines, so every block can be decompressed and parsed on its own.
+ *
+ * Blocks use an LZ77 encoding in the style of LZ4: a token byte holds the
+ * literal run length in its high nibble and the match length minus ZMINMATCH
+ * in its low nibble, with 15 meaning that more length bytes follow. The
+ * literals come next and then a 16-bit little-endian match offset. The last
+ * sequence of a block has literals only. */
+#define ZMAGIC "c12z\0\0\0\1"
+#define ZHEADER 8
+#define ZMINMATCH 4
+#define ZHASHBITS 14
+#define ZBOUND(n) ((n) + (n) / 255 + 16)
+
+uint32_t getle32(const char *p) {
+  const uint8_t *q = (const uint8_t *)p;
+  return q[0] | q[1] << 8 | q[2] << 16 | (uint32_t)q[3] << 24;
+}
+
+void putle32(char *p, uint32_t x) {
+  p[0] = x;
+  p[1] = x >> 8;
+  p[2] = x >> 16;
+  p[3] = x >> 24;
+}
+
+char *zputlen(char *out, int len) {
+  for (; len >= 255; len -= 255)
+    *out++ = (char)255;
+  *out++ = len;
+  return out;
+}
+
+char *zputsequence(char *out, const char *lit, int nlit, int off, int len) {
+  char *token = out++;
+  *token = (nlit < 15 ? nlit : 15) << 4;
+  if (nlit >= 15)
+    out = zputlen(out, nlit - 15);
+  memmove(out, lit, nlit);
+  out += nlit;
+  if (!len)
+    return out;
+  len -= ZMINMATCH;
+  *token |= len < 15 ? len : 15;
+  *out++ = off;
+  *out++ = off >> 8;
+  if (len >= 15)
+    out = zputlen(out, len - 15);
+  return out;
+}
+
+/* Compress in[0:size] into out, which must hold ZBOUND(size) bytes. */
+int zcompress(const char *in, int size, char *out) {
+  int table[1 << ZHASHBITS], i = 0, anchor = 0, len, cand;
+  char *o = out;
+  uint32_t x;
+
+  memset(table, 0xff, sizeof(table));
+  while (i + ZMINMATCH <= size) {
+    memmove(&x, in + i, sizeof(x));
+    x = (x * 2654435761u) >> (32 - ZHASHBITS);
+    cand = table[x];
+    table[x] = i;
+    if (cand < 0 || i - cand > 0xffff || memcmp(in + cand, in + i, ZMINMATCH)) {
+      i++;
+      continue;
+    }
+    for (len = ZMINMATCH; i + len < size && in[cand + len] == in[i + len];)
+      len++;
+    o = zputsequence(o, in + anchor, i - anchor, i - cand, len);
+    i += len;
+    anchor = i;
+  }
+  return zputsequence(o, in + anchor, size - anchor, 0, 0) - out;
+}
+
+int zgetlen(const uint8_t **pp, const uint8_t *end, int len) {
+  const uint8_t *p = *pp;
+  if (len == 15)
+    do {
+      if (p == end)
+        return -1;
+      len += *p;
+    } while (*p++ == 255);
+  *pp = p;
+  return len;
+}
+
+/* Decompress in[0:size] into out, which holds outsize bytes. Returns the
+ * number of bytes written or -1 if the input is corrupt. */
+KERNEL int zdecompress(const char *in, int size, char *out, int outsize) {
+  const uint8_t *p = (const uint8_t *)in, *end = p + size;
+  char *o = out, *oend = out + outsize, *q;
+  int token, nlit, off, len;
+
+  while (p < end) {
+    token = *p++;
+    if ((nlit = zgetlen(&p, end, token >> 4)) < 0 || nlit > end - p ||
+        nlit > oend - o)
+      return -1;
+    memmove(o, p, nlit);
+    o += nlit;
+    p += nlit;
+    if (p == end)
+      break;
+    if (end - p < 2)
+      return -1;
+    off = p[0] | p[1] << 8;
+    p += 2;
+    if ((len = zgetlen(&p, end, token & 15)) < 0)
+      return -1;
+    len += ZMINMATCH;
+    if (!off || off > o - out || len > oend - o)
+      return -1;
+    for (q = o - off; len--;)
+      *o++ = *q++;
+  }
+  return o - out;
+}
+
+/* Decompress the block at p into the thread-local buffer and return its
+ * size. */
+int unblock(struct threaddata *t, const char *p) {
+  int size = getle32(p), zsize = getle32(p + 4);
+  if (!t->zbuf)
+    assert(t->zbuf = malloc(CHUNKSIZE));
+  if (size > CHUNKSIZE ||
+      zdecompress(p + ZHEADER, zsize, t->zbuf, size) != size ||
+      (size && t->zbuf[size - 1] != '\n'))
+    errx(-1, "corrupt c12z block");
+  return size;
+}
+
+/* Compress a regular file on fd into c12z format on stdout. */
+void compressinput(int fd) {
+  struct stat st;
+  char *in, *p, *end, *out;
+  int size, zsize;
+
+  if (fstat(fd, &st))
+    err(-1, "fstat");
+  if (!S_ISREG(st.st_mode))
+    errx(-1, "-compress needs a regular file on stdin");
+  fwrite(ZMAGIC, 1, ZHEADER, stdout);
+  if (!st.st_size)
+    return;
+  if ((in = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    err(-1, "mmap");
+  if (in[st.st_size - 1] != '\n')
+    errx(-1, "missing newline at end of input");
+  assert(out = malloc(ZHEADER + ZBOUND(CHUNKSIZE)));
+
+  for (p = in; p < in + st.st_size; p = end) {
+    end = p + CHUNKSIZE < in + st.st_size ? p + CHUNKSIZE : in + st.st_size;
+    while (end[-1] != '\n')
+      if (--end == p)
+        errx(-1, "line longer than %d bytes", CHUNKSIZE);
+    size = end - p;
+    zsize = zcompress(p, size, out + ZHEADER);
+    putle32(out, size);
+    putle32(out + 4, zsize);
+    if (fwrite(out, 1, ZHEADER + zsize, stdout) != ZHEADER + zsize)
+      err(-1, "write");
+  }
+  free(out);
+}
+
+void testblock(void) {
+  char *in = "Hamburg;12.0\nBulawayo;8.9\nPalembang;38.8\nHamburg;34.2\n"
+             "St. John's;15.2\nHamburg;12.0\nHamburg;12.0\naaaaaaaaaaaaaaaaa"
+             "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+             "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+             "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+             "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+             "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa;1.0\n";
+  char z[1024], out[1024];
+  int size, zsize, n, failed = 0, f;
+
+  for (size = 0; size <= strlen(in); size++) {
+    f = 0;
+    zsize = zcompress(in, size, z);
+    if (zsize > ZBOUND(size))
+      failf(&f, "size=%d: compressed size %d out of bounds", size, zsize);
+    if ((n = zdecompress(z, zsize, out, size)) != size)
+      failf(&f, "size=%d: decompressed %d bytes", size, n);
+    else if (memcmp(in, out, size))
+      failf(&f, "size=%d: decompressed data differs", size);
+    if (size > 1 && zdecompress(z, zsize, out, size - 1) >= 0)
+      failf(&f, "size=%d: output overflow not detected", size);
+    failed += !!f;
+  }
+  if (failed)
+    warnx("testblock: %d/%d tests failed", failed, size);
+  else
+    warnx("testblock: %d tests ok", size);
+}
+
+enum { PLAIN, BLOCKZ, GZIP, COLUMNAR };
+
+/* A mapped input file. Plain files always end in a newline so parsing a
+ * chunk never reads past end. */
+struct input {
+  char *start, *end, *path;
+  int format;
+  /* Station dictionary of a columnar file: names[id] is terminated by ';'. */
+  int nstations;
+  const char **names;
+};
+
+struct inputlist {
+  struct input *in;
+  int nin;
+  struct work *work;
+  int nwork;
+} inputlist;
+
+/* c12c is a columnar format for datasets that are aggregated repeatedly.
+ * After a header of COLMAGIC, the number of stations and the size of a
+ * station ID, comes the station dictionary as length-prefixed names, padded
+ * to 8 bytes. Then follow blocks of up to COLROWS rows: a header with the
+ * row count and 4 reserved zero bytes, the station ID column, and the value
+ * column as int16 tenths, each block padded to 8 bytes. All integers are
+ * little-endian. Aggregating a block is a direct index into a per-thread
+ * array: there is no hashing and no text parsing. A station ID is 2 bytes,
+ * which holds the MAXRECORDS stations of a table. */
+#define COLMAGIC "c12c\0\0\0\1"
+#define COLHEADER 16
+#define COLBLOCKHEADER 8
+#define COLIDSIZE 2
+#if MAXRECORDS > 1 << 8 * COLIDSIZE
+#error "c12c station IDs cannot number MAXRECORDS stations"
+#endif
+#define COLROWS (1 << 17)
+#define PAD8(n) (((n) + 7) & ~7)
+
+struct colagg {
+  int64_t total;
+  int32_t num;
+  int16_t min, max;
+};
+
+int colblocksize(struct input *in, const char *block) {
+  return COLBLOCKHEADER + PAD8(getle32(block) * (COLIDSIZE + 2));
+}
+
+/* Parse the dictionary of the columnar file in and return its first block. */
+char *coldictionary(struct input *in) {
+  char *p = in->start + COLHEADER, *names;
+  int i, len;
+
+  if (in->end - in->start < COLHEADER)
+    errx(-1, "%s: truncated c12c header", in->path);
+  in->nstations = getle32(in->start + 8);
+  if (getle32(in->start + 12) != COLIDSIZE)
+    errx(-1, "%s: bad c12c station ID size %d", in->path,
+         (int)getle32(in->start + 12));
+  assert(in->names = malloc(in->nstations * sizeof(*in->names)));
+  assert(names = malloc(in->nstations * (NAMEMAX + 1)));
+  for (i = 0; i < in->nstations; i++) {
+    if (p >= in->end || (len = (uint8_t)*p) > in->end - p - 1)
+      errx(-1, "%s: truncated c12c dictionary", in->path);
+    memmove(names, p + 1, len);
+    names[len] = ';';
+    in->names[i] = names;
+    names += len + 1;
+    p += 1 + len;
+  }
+  return in->start + PAD8(p - in->start);
+}
+
+void aggrow(struct colagg *agg, struct input *in, uint32_t id, int16_t val) {
+  struct colagg *a = agg + id;
+  if (id >= in->nstations)
+    errx(-1, "%s: station ID %u out of range", in->path, id);
+  if (val < a->min)
+    a->min = val;
+  if (val > a->max)
+    a->max = val;
+  a->total += val;
+  a->num++;
+}
+
+KERNEL void aggcolumns(struct threaddata *t, struct input *in,
+                       const char *block) {
+  int n = getle32(block), i, k = in - inputlist.in;
+  const uint16_t *ids = (const uint16_t *)(block + COLBLOCKHEADER);
+  const int16_t *val = (const int16_t *)(ids + n);
+  struct colagg *agg, *a;
+
+  if (!t->col)
+    assert(t->col = calloc(inputlist.nin, sizeof(*t->col)));
+  if (!(agg = t->col[k])) {
+    assert(agg = t->col[k] = malloc(in->nstations * sizeof(*agg)));
+    for (a = agg; a < agg + in->nstations; a++) {
+      a->total = a->num = 0;
+      a->min = INT16_MAX;
+      a->max = INT16_MIN;
+    }
+  }
+
+  for (i = 0; i < n; i++)
+    aggrow(agg, in, ids[i], val[i]);
+}
+
+void mergecolumns(struct threaddata *t0, struct colagg *agg,
+                  struct input *in) {
+  int id;
+  for (id = 0; agg && id < in->nstations; id++)
+    if (agg[id].num)
+      updaterecord(upsertstr(t0, (char *)in->names[id]), agg[id].total,
+                   agg[id].num, agg[id].min, agg[id].max);
+}
+
+/* Convert a regular file of text rows on fd into c12c format on stdout. The
+ * first pass builds the station dictionary with parseplain, whatever the
+ * options, and the second writes the blocks. */
+void columnarinput(int fd) {
+  struct threaddata *t = threaddata;
+  struct stat st;
+  struct record *r;
+  char *in, *line, *p, *out, hdr[COLHEADER];
+  uint16_t *id;
+  int16_t *val;
+  int64_t x;
+  int n = 0, size;
+
+  if (fstat(fd, &st))
+    err(-1, "fstat");
+  if (!S_ISREG(st.st_mode))
+    errx(-1, "-columnar needs a regular file on stdin");
+  in = 0;
+  if (st.st_size &&
+      (in = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    err(-1, "mmap");
+  sourceset(&t->src, "stdin", in, in + st.st_size, 0, SOURCEFILE);
+  if (st.st_size && in[st.st_size - 1] != '\n')
+    badinput(&t->src, in + st.st_size, "missing newline at end of input");
+  if (st.st_size && !lastline(in, in + st.st_size))
+    badinput(&t->src, in + st.st_size - 1, "missing ';'");
+  t->fixed = values.scale == 1;
+  parseplain(t, in, in + st.st_size);
+
+  memmove(hdr, COLMAGIC, 8);
+  putle32(hdr + 8, t->nrecords);
+  putle32(hdr + 12, COLIDSIZE);
+  fwrite(hdr, 1, sizeof(hdr), stdout);
+  size = sizeof(hdr);
+  for (r = t->records; r < t->records + t->nrecords; r++) {
+    putchar(namelen(r));
+    fwrite(r->fullname, 1, namelen(r), stdout);
+    size += 1 + namelen(r);
+  }
+  for (; size % 8; size++)
+    putchar(0);
+
+  assert(out = calloc(COLBLOCKHEADER + PAD8(COLROWS * (COLIDSIZE + 2)), 1));
+  id = (uint16_t *)(out + COLBLOCKHEADER);
+  for (line = in; line < in + st.st_size || n;) {
+    if (n == COLROWS || line == in + st.st_size) {
+      val = (int16_t *)(id + n);
+      memmove(val, id + COLROWS, n * sizeof(*val));
+      putle32(out, n);
+      size = COLBLOCKHEADER + PAD8(n * (COLIDSIZE + 2));
+      memset(out + COLBLOCKHEADER + n * (COLIDSIZE + 2), 0,
+             size - COLBLOCKHEADER - n * (COLIDSIZE + 2));
+      if (fwrite(out, 1, size, stdout) != size)
+        err(-1, "write");
+      n = 0;
+      continue;
+    }
+
+    for (p = line; *p != ';'; p++)
+      ;
+    r = upsertsz(t, line, p - line);
+    p++;
+    val = (int16_t *)(id + COLROWS);
+    x = parsenum(t, &p, '\n');
+    if (x != (int16_t)x)
+      badinput(&t->src, line, "value does not fit in 16 bits");
+    val[n] = x;
+    id[n] = r - t->records;
+    n++;
+    line = p + 1;
+  }
+  free(out);
+}
+
+/* A unit of work for processinput: either one chunk of a large file, one
+ * c12z block or a pack of whole small files, so that threads stay busy when
+ * the input is sharded into many small files. */
+struct work {
+  struct input *in;
+  int nin;
+  char *chunk;
+};
+
+/* -stats reports wall time and counters for each phase of the main thread,
+ * and for the parse phase of each worker. The parse phase of the main thread
+ * also includes the counts of all workers. It then shows how the work was
+ * spread over the workers. Every output path ends the sort phase once its
+ * stations are in order. -window sorts each window as it prints it, and
+ * spilled runs only fill the -groups levels as they are merged into the
+ * output, so that sorting counts as output. -trace writes the phases
+ * and the work items of each thread as a Chrome trace, to be opened in
+ * chrome://tracing or Perfetto. Without either of them the only cost is a
+ * test of timing per work item. */
+enum { MAP, PARSE, MERGE, SORT, OUTPUT, NPHASE };
+const char *phasename[NPHASE] = {"map", "parse", "merge", "sort", "output"};
+
+int stats, timing;
+const char *tracepath;
+int64_t epoch;
+struct counters statscounters;
+struct sample statsmark, phase[NPHASE];
+struct span phasespan[NPHASE];
+
+void statsbegin(void) {
+  int i;
+  if (!timing)
+    return;
+  for (i = 0; i < NCOUNTER; i++)
+    statscounters.fd[i] = -1;
+  if (stats)
+    countersopen(&statscounters);
+  countersread(&statscounters, &statsmark);
+  epoch = statsmark.ns;
+}
+
+/* statsphase ends phase p of the main thread and starts the next one. */
+void statsphase(int p) {
+  struct sample now;
+  if (!timing)
+    return;
+  countersread(&statscounters, &now);
+  sampleadd(phase + p, &statsmark, &now);
+  phasespan[p].start = statsmark.ns;
+  phasespan[p].end = now.ns;
+  statsmark = now;
+}
+
+void printsample(const char *name, struct sample *s) {
+  int i;
+
+  fprintf(stderr, "%-10s %10.1f", name, (double)s->ns / 1e6);
+  for (i = 0; i < NCOUNTER; i++)
+    if (s->count[i] < 0)
+      fprintf(stderr, " %14s", "-");
+    else
+      fprintf(stderr, " %14.0f", (double)s->count[i]);
+  if (s->count[CYCLES] > 0 && s->count[INSTRUCTIONS] >= 0)
+    fprintf(stderr, " %5.2f\n",
+            (double)s->count[INSTRUCTIONS] / (double)s->count[CYCLES]);
+  else
+    fprintf(stderr, " %5s\n", "-");
+}
+
+void printstats(struct threaddata *t0) {
+  struct sample total;
+  struct threaddata *t;
+  struct record *r;
+  int64_t rows, busy = 0, maxbusy = 0, first = 0, last = 0;
+  char name[16];
+  int i, nbusy = 0;
+
+  if (!stats)
+    return;
+  countersclose(&statscounters);
+
+  for (t = threaddata; t < endof(threaddata); t++)
+    for (i = 0; i < NCOUNTER; i++)
+      if (t->parse.count[i] < 0 || phase[PARSE].count[i] < 0)
+        phase[PARSE].count[i] = -1;
+      else
+        phase[PARSE].count[i] += t->parse.count[i];
+  memset(&total, 0, sizeof(total));
+  for (i = 0; i < NPHASE; i++) {
+    struct sample zero = {0};
+    sampleadd(&total, &zero, phase + i);
+  }
+
+  fprintf(stderr, "%-10s %10s", "phase", "ms");
+  for (i = 0; i < NCOUNTER; i++)
+    fprintf(stderr, " %14s", countername[i]);
+  fprintf(stderr, " %5s\n", "IPC");
+  for (i = 0; i < NPHASE; i++)
+    printsample(phasename[i], phase + i);
+  printsample("total", &total);
+  rows = windows.rows + spill.rows + validation.lines;
+  for (r = t0->records; r < t0->records + t0->nrecords; r++)
+    rows += r->num;
+  for (r = shared.records; r < shared.records + shared.nrecords; r++)
+    rows += r->num;
+  for (t = threaddata; t < endof(threaddata); t++)
+    rows += t->approx ? t->approx->rows : 0;
+  for (t = threaddata; t < endof(threaddata); t++) {
+    sprintf(name, "thread %d", (int)(t - threaddata));
+    printsample(name, &t->parse);
+  }
+  fprintf(stderr, "%lld rows, %.0f rows/s parsing, %.0f rows/s overall\n",
+          (long long)rows, (double)rows * 1e9 / (double)phase[PARSE].ns,
+          (double)rows * 1e9 / (double)total.ns);
+
+  fprintf(stderr, "\n%-10s %8s %10s %12s %10s %10s %10s\n", "thread", "chunks",
+          "MB", "rows", "busy ms", "idle ms", "finish ms");
+  for (t = threaddata; t < endof(threaddata); t++) {
+    double finish = t->nchunks ? t->finish - phasespan[PARSE].start : 0;
+    sprintf(name, "thread %d", (int)(t - threaddata));
+    fprintf(stderr, "%-10s %8lld %10.1f %12lld %10.1f %10.1f %10.1f\n", name,
+            (long long)t->nchunks, (double)t->nbytes / 1e6,
+            (long long)t->nrows, (double)t->busy / 1e6,
+            (finish - (double)t->busy) / 1e6, finish / 1e6);
+    if (!t->nchunks)
+      continue;
+    busy += t->busy;
+    if (t->busy > maxbusy)
+      maxbusy = t->busy;
+    if (!first || t->finish < first)
+      first = t->finish;
+    if (t->finish > last)
+      last = t->finish;
+    nbusy++;
+  }
+  fprintf(stderr,
+          "busiest thread %.2fx the mean busy time, finish times %.1f ms "
+          "apart, merge %.1f ms\n",
+          nbusy ? (double)maxbusy * nbusy / (double)busy : 0,
+          (double)(last - first) / 1e6, (double)phase[MERGE].ns / 1e6);
+}
+
+/* printhtstats prints the hash table counters of each thread. It runs
+ * before the merge, which does upserts of its own in thread 0. Full misses
+ * are names that matched in shortname but differ further on. */
+void printhtstats(void) {
+#if HTSTATS
+  struct threaddata *t;
+  struct htstats *h;
+  int64_t probes[PROBEMAX + 1] = {0}, sum;
+  char name[16];
+  int i, max;
+
+  fprintf(stderr, "%-10s %6s %6s %8s %12s %7s %4s %12s %12s %12s\n", "thread",
+          "keys", "load", "rehashes", "upserts", "probes", "max", "short hits",
+          "full hits", "full misses");
+  for (t = threaddata; t < endof(threaddata); t++) {
+    h = &t->ht;
+    for (i = 0, sum = 0, max = 0; i <= PROBEMAX; i++) {
+      sum += i * h->probes[i];
+      probes[i] += h->probes[i];
+      if (h->probes[i])
+        max = i;
+    }
+    sprintf(name, "thread %d", (int)(t - threaddata));
+    fprintf(stderr,
+            "%-10s %6d %6.3f %8d %12lld %7.3f %4d %12lld %12lld %12lld\n", name,
+            t->nrecords, (double)t->nrecords / (1 << EXP), t->nrehash,
+            (long long)h->upserts,
+            h->upserts ? (double)sum / (double)h->upserts : 0, max,
+            (long long)h->shorthits, (long long)h->fullhits,
+            (long long)(h->fullcompares - h->fullhits));
+  }
+  fprintf(stderr, "\n%7s %12s\n", "probes", "upserts");
+  for (i = 0; i <= PROBEMAX; i++)
+    if (probes[i])
+      fprintf(stderr, "%6d%s %12lld\n", i, i == PROBEMAX ? "+" : " ",
+              (long long)probes[i]);
+#endif
+}
+
+/* statsthread opens the counters of a worker thread and statsthreadend adds
+ * what they counted to the parse phase of that thread. Rows are counted at
+ * the end from the records, and not per line. */
+void statsthread(struct counters *c, struct sample *start) {
+  if (!stats)
+    return;
+  countersopen(c);
+  countersread(c, start);
+}
+
+void statsthreadend(struct threaddata *t, struct counters *c,
+                    struct sample *start) {
+  struct sample end;
+  struct record *r;
+  struct input *in;
+  struct colagg *a;
+
+  if (!timing)
+    return;
+  for (r = t->records; r < t->records + t->nrecords; r++)
+    t->nrows += r->num;
+  for (in = inputlist.in; t->col && in < inputlist.in + inputlist.nin; in++)
+    for (a = t->col[in - inputlist.in];
+         a && a < t->col[in - inputlist.in] + in->nstations; a++)
+      t->nrows += a->num;
+  if (!stats)
+    return;
+  countersread(c, &end);
+  sampleadd(&t->parse, start, &end);
+  countersclose(c);
+}
+
+/* workstart and workdone bracket each work item of a worker thread. */
+int64_t workstart(void) { return timing ? nanotime() : 0; }
+
+void workdone(struct threaddata *t, int64_t start, int64_t bytes) {
+  struct span *s;
+  if (!timing)
+    return;
+  t->finish = nanotime();
+  t->busy += t->finish - start;
+  t->nchunks++;
+  t->nbytes += bytes;
+  if (tracepath) {
+    t->spans = grow(t->spans, t->nspans, sizeof(*t->spans));
+    s = t->spans + t->nspans++;
+    s->start = start;
+    s->end = t->finish;
+    s->bytes = bytes;
+  }
+}
+
+void tracespan(FILE *f, const char *name, int tid, struct span *s) {
+  fprintf(f,
+          ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+          "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%lld}}",
+          name, tid, (double)(s->start - epoch) / 1e3,
+          (double)(s->end - s->start) / 1e3, (long long)s->bytes);
+}
+
+void writetrace(void) {
+  struct threaddata *t;
+  struct span *s;
+  FILE *f;
+  int i;
+
+  if (!tracepath)
+    return;
+  if (!(f = fopen(tracepath, "w")))
+    err(-1, "open %s", tracepath);
+  fputs("{\"traceEvents\":[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+        "\"tid\":0,\"args\":{\"name\":\"main\"}}",
+        f);
+  for (i = 0; i < NPHASE; i++)
+    tracespan(f, phasename[i], 0, phasespan + i);
+  for (t = threaddata; t < endof(threaddata); t++) {
+    i = t - threaddata + 1;
+    fprintf(f,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"thread %d\"}}",
+            i, i - 1);
+    for (s = t->spans; s < t->spans + t->nspans; s++)
+      tracespan(f, "work", i, s);
+  }
+  fputs("\n]}\n", f);
+  if (fclose(f))
+    err(-1, "write %s", tracepath);
+}
+
+/* Microbenchmarks for the hot kernels. Each kernel runs over a fixed input
+ * generated from a fixed seed and reports ns/op and, if perf_event_open is
+ * available, instructions/op. */
+#define BENCHOPS (1 << 24)
+#define BENCHNUMS (1 << 16)
+#define BENCHSEQ (1 << 16)
+
+volatile int64_t benchsink;
+struct counters benchcounters;
+
+struct bench {
+  char name[64];
+  struct sample start;
+};
+
+uint32_t benchrandom(uint32_t *state) {
+  *state = *state * 1664525 + 1013904223;
+  return *state >> 8;
+}
+
+void benchinit(void) {
+  countersopen(&benchcounters);
+  if (benchcounters.fd[INSTRUCTIONS] < 0)
+    warnx("perf_event_open not available, not counting instructions");
+}
+
+void benchstart(struct bench *b) { countersread(&benchcounters, &b->start); }
+
+void benchstop(struct bench *b, int64_t nops) {
+  struct sample end, d = {0};
+
+  countersread(&benchcounters, &end);
+  sampleadd(&d, &b->start, &end);
+  printf("%-32s %8.2f ns/op", b->name, (double)d.ns / (double)nops);
+  if (d.count[INSTRUCTIONS] >= 0)
+    printf(" %8.2f instructions/op",
+           (double)d.count[INSTRUCTIONS] / (double)nops);
+  putchar('\n');
+}
+
+/* benchnumbers returns n newline-terminated temperatures between -99.9 and
+ * 99.9, followed by padding so that kernels may read 8 bytes past the last
+ * one. */
+char *benchnumbers(int n, char **end) {
+  uint32_t state = 1;
+  char *buf, *p;
+  int i;
+
+  assert(p = buf = malloc(7 * n + 8));
+  for (i = 0; i < n; i++) {
+    int x = benchrandom(&state) % 1999 - 999;
+    p += sprintf(p, "%s%d.%d\n", x < 0 ? "-" : "", abs(x) / 10, abs(x) % 10);
+  }
+  *end = p;
+  memset(p, 0, 8);
+  return buf;
+}
+
+/* benchnames returns n distinct semicolon-terminated station names of at
+ * most 25 bytes and stores pointers to them in names. */
+char *benchnames(int n, char **names) {
+  uint32_t state = 1;
+  char *buf, *p;
+  int i, j, len;
+
+  assert(p = buf = malloc(32 * n));
+  for (i = 0; i < n; i++) {
+    names[i] = p;
+    len = 1 + benchrandom(&state) % 20;
+    for (j = 0; j < len; j++)
+      *p++ = (j ? 'a' : 'A') + benchrandom(&state) % 26;
+    p += sprintf(p, "%d;", i);
+  }
+  return buf;
+}
+
+/* parsenum with parsefixed and with parsescaled only. */
+void benchparsenum(void) {
+  struct threaddata *t;
+  struct bench b;
+  char *in, *end, *p;
+  int64_t sum = 0, n;
+  int i, fixed;
+
+  assert(t = calloc(1, sizeof(*t)));
+  in = benchnumbers(BENCHNUMS, &end);
+  sourceset(&t->src, "bench", in, end + 8, 0, SOURCEFILE);
+  for (fixed = 1; fixed >= 0; fixed--) {
+    strcpy(b.name, fixed ? "parsenum fixed" : "parsenum scaled");
+    benchstart(&b);
+    for (i = n = 0; i < BENCHOPS / BENCHNUMS; i++)
+      for (p = in, t->fixed = fixed; p < end; p++, n++)
+        sum += parsenum(t, &p, '\n');
+    benchstop(&b, n);
+  }
+  benchsink = sum;
+  free(in);
+  free(t);
+}
+
+/* nextsep over lines of a name and two values, against a byte loop. */
+void benchfields(void) {
+  static char *names[BENCHNUMS];
+  struct fields f;
+  struct bench b;
+  char *buf, *in, *p, *end;
+  const char *q;
+  int64_t sum = 0, n;
+  int i, bytes;
+
+  buf = benchnames(BENCHNUMS, names);
+  assert(p = in = malloc(BENCHNUMS * 48));
+  for (i = 0; i < BENCHNUMS; i++)
+    p += sprintf(p, "%.*s,%d.%d,%d\n", (int)(strchr(names[i], ';') - names[i]),
+                 names[i], i % 100, i % 10, i % 1000);
+  end = p;
+  for (bytes = 0; bytes < 2; bytes++) {
+    strcpy(b.name, bytes ? "fields bytes" : "fields mask");
+    schema.delimiter = ',';
+    benchstart(&b);
+    for (i = n = 0; i < BENCHOPS / BENCHNUMS / 4; i++) {
+      f.base = q = in;
+      f.end = end;
+      f.bits = separators(f.base, f.end);
+      for (; q < end; q++, n++) {
+        if (bytes)
+          for (; *q != ',' && *q != '\n'; q++)
+            ;
+        else
+          q = nextsep(&f, q);
+        sum += *q;
+      }
+    }
+    benchstop(&b, n);
+    schema.delimiter = ';';
+  }
+  benchsink = sum;
+  free(in);
+  free(buf);
+}
+
+void benchhash(void) {
+  static char *names[BENCHNUMS];
+  struct bench b;
+  char *buf, *p;
+  uint64_t sum = 0;
+  int64_t n = 0;
+  int i, j;
+
+  buf = benchnames(BENCHNUMS, names);
+  strcpy(b.name, "hash");
+  benchstart(&b);
+  for (i = 0; i < BENCHOPS / BENCHNUMS; i++)
+    for (j = 0; j < BENCHNUMS; j++, n++) {
+      uint64_t hash = 0;
+      for (p = names[j]; *p != ';'; p++)
+        hashupdate(&hash, 111, *p);
+      sum += hash;
+    }
+  benchstop(&b, n);
+  benchsink = sum;
+  free(buf);
+}
+
+/* benchupsert looks up random keys in a table that already holds all of
+ * them, which is the steady state of processinput. Hashes are computed up
+ * front, after any rehash during the inserts, so that only upsert is
+ * measured. The same keys are then looked up in the -engine shared table,
+ * which holds the keys of the earlier rounds too. */
+void benchupsert(void) {
+  static char *names[BENCHNUMS];
+  static int sizes[BENCHNUMS], seq[BENCHSEQ];
+  static uint64_t hashes[BENCHNUMS];
+  int nkeys[] = {1 << 8, 1 << 12, 1 << 14}, *k, i, j;
+  uint32_t state = 1;
+  struct threaddata *t;
+  struct bench b;
+  char *buf;
+  int64_t sum = 0, n;
+
+  buf = benchnames(BENCHNUMS, names);
+  for (i = 0; i < BENCHNUMS; i++)
+    sizes[i] = strchr(names[i], ';') - names[i];
+  sharedstart(111);
+
+  for (k = nkeys; k < endof(nkeys); k++) {
+    if (*k > nelem(threaddata->records))
+      break;
+    assert(t = calloc(1, sizeof(*t)));
+    t->hashkey = 111;
+    for (i = 0; i < *k; i++)
+      upsertsz(t, names[i], sizes[i]);
+    for (i = 0; i < *k; i++)
+      hashes[i] = hashsz(t->hashkey, names[i], sizes[i]);
+    for (i = 0; i < BENCHSEQ; i++)
+      seq[i] = benchrandom(&state) % *k;
+
+    sprintf(b.name, "upsert keys=%d load=%.2f", *k, (double)*k / (1 << EXP));
+    benchstart(&b);
+    for (i = 0, n = 0; i < BENCHOPS / BENCHSEQ; i++)
+      for (j = 0; j < BENCHSEQ; j++, n++)
+        sum += upsert(t, names[seq[j]], sizes[seq[j]], hashes[seq[j]])->num;
+    benchstop(&b, n);
+
+    for (i = 0; i < *k; i++)
+      sharedupsert(t, names[i], sizes[i], hashsz(111, names[i], sizes[i]));
+    for (i = 0; i < *k; i++)
+      hashes[i] = hashsz(111, names[i], sizes[i]);
+    sprintf(b.name, "upsert shared keys=%d load=%.2f", *k,
+            (double)shared.nrecords / (1 << SHAREDEXP));
+    benchstart(&b);
+    for (i = 0, n = 0; i < BENCHOPS / BENCHSEQ; i++)
+      for (j = 0; j < BENCHSEQ; j++, n++)
+        sum += sharedupsert(t, names[seq[j]], sizes[seq[j]], hashes[seq[j]])
+                   ->num;
+    benchstop(&b, n);
+    free(t);
+  }
+
+  benchsink = sum;
+  free(buf);
+}
+
+void bench(void) {
+  benchinit();
+  benchparsenum();
+  benchfields();
+  benchhash();
+  benchupsert();
+}
+
+/* -top K STAT and -bottom K STAT print only the K stations with the highest
+ * or lowest min, mean or max, best first, instead of all of them by name.
+ * Each thread keeps the best K of a slice of the merged table in a heap
+ * whose root is the worst of those K, and the main thread merges the heaps.
+ * Ties are broken by name so the output does not depend on the split. */
+enum { BYMIN, BYMEAN, BYMAX };
+const char *statname[] = {"min", "mean", "max"};
+
+struct query {
+  int k, by, top;
+} query;
+
+#define TOPSLICE 4096
+
+struct topslice {
+  struct record *start, *end, **heap;
+  int n, filtered;
+  pthread_t thread;
+};
+
+double recordstat(const struct record *r) {
+  if (query.by == BYMIN)
+    return r->min;
+  if (query.by == BYMAX)
+    return r->max;
+  return (double)r->total / (double)r->num;
+}
+
+/* recordbefore returns whether a is printed before b. */
+int recordbefore(const struct record *a, const struct record *b) {
+  double x = recordstat(a), y = recordstat(b);
+  if (x != y)
+    return query.top ? x > y : x < y;
+  return recordnameasc(a, b) < 0;
+}
+
+int recordrank(const void *a, const void *b) {
+  return recordbefore(*(struct record **)b, *(struct record **)a) -
+         recordbefore(*(struct record **)a, *(struct record **)b);
+}
+
+void heapswap(struct record **h, int i, int j) {
+  struct record *r = h[i];
+  h[i] = h[j];
+  h[j] = r;
+}
+
+/* heappush adds r to the heap h of at most k records if it is better than
+ * the worst one, which it then replaces. */
+void heappush(struct record **h, int *n, int k, struct record *r) {
+  int i, child;
+
+  if (*n < k) {
+    for (i = (*n)++, h[i] = r; i && recordbefore(h[(i - 1) / 2], h[i]);
+         i = (i - 1) / 2)
+      heapswap(h, i, (i - 1) / 2);
+    return;
+  }
+  if (!recordbefore(r, h[0]))
+    return;
+  for (h[0] = r, i = 0; (child = 2 * i + 1) < *n; i = child) {
+    if (child + 1 < *n && recordbefore(h[child], h[child + 1]))
+      child++;
+    if (!recordbefore(h[i], h[child]))
+      break;
+    heapswap(h, i, child);
+  }
+}
+
+void *topselect(void *data) {
+  struct topslice *s = data;
+  struct record *r;
+
+  for (r = s->start; r < s->end; r++)
+    if (!s->filtered || filterkeep(r->fullname, namelen(r)))
+      heappush(s->heap, &s->n, query.k, r);
+  return 0;
+}
+
+/* topk stores the best query.k of the nrecords records in top, best first,
+ * and returns how many there are. If filtered is set, only records that pass
+ * -stations or -exclude count. Small tables are not worth a thread. */
+int topk(struct record *records, int nrecords, int filtered,
+         struct record **top) {
+  struct topslice slices[NTHREAD], *s;
+  int nslices, per, n = 0, i;
+
+  nslices = (nrecords + TOPSLICE - 1) / TOPSLICE;
+  if (nslices > NTHREAD)
+    nslices = NTHREAD;
+  if (nslices < 1)
+    nslices = 1;
+  per = (nrecords + nslices - 1) / nslices;
+  for (s = slices; s < slices + nslices; s++) {
+    s->start = records + (s - slices) * per;
+    s->end = s + 1 < slices + nslices ? s->start + per : records + nrecords;
+    assert(s->heap = malloc(query.k * sizeof(*s->heap)));
+    s->n = 0;
+    s->filtered = filtered;
+    if (nslices > 1) {
+      assert(!pthread_create(&s->thread, 0, topselect, s));
+    } else {
+      topselect(s);
+    }
+  }
+  for (s = slices; s < slices + nslices; s++) {
+    if (nslices > 1)
+      assert(!pthread_join(s->thread, 0));
+    for (i = 0; i < s->n; i++)
+      heappush(top, &n, query.k, s->heap[i]);
+    free(s->heap);
+  }
+  qsort(top, n, sizeof(*top), recordrank);
+  return n;
+}
+
+void printrecord(const struct record *r, int first) {
+  if (!first)
+    fputs(", ", stdout);
+  fwrite(r->fullname, 1, namelen(r), stdout);
+  printvalues(r, '=');
+}
+
+/* sorttable puts records in output order: all of them sorted by name, or
+ * for -top and -bottom the best query.k of them in a new array *top. It
+ * returns the number of records in *top. */
+int sorttable(struct record *records, int nrecords, int filtered,
+              struct record ***top) {
+  *top = 0;
+  if (!query.k) {
+    qsort(records, nrecords, sizeof(*records), recordnameasc);
+    return 0;
+  }
+  assert(*top = malloc(query.k * sizeof(**top)));
+  return topk(records, nrecords, filtered, *top);
+}
+
+/* printtable prints the records ordered by sorttable on one line and
+ * frees top. */
+void printtable(struct record *records, int nrecords, int filtered,
+                struct record **top, int ntop) {
+  struct record *r;
+  int i;
+
+  putchar('{');
+  for (i = 0; i < ntop; i++)
+    printrecord(top[i], !i);
+  for (r = records; !top && r < records + nrecords; r++)
+    if (!filtered || filterkeep(r->fullname, namelen(r)))
+      printrecord(r, !i++);
+  puts("}");
+  free(top);
+}
+
+void parsequery(int top, const char *k, const char *stat) {
+  char *end;
+  long n = strtol(k, &end, 10);
+
+  if (*end || n < 1 || n > MAXRECORDS)
+    errx(-1, "bad count %s, want 1 to %d", k, MAXRECORDS);
+  for (query.by = 0; query.by < nelem(statname); query.by++)
+    if (!strcmp(statname[query.by], stat))
+      break;
+  if (query.by == nelem(statname))
+    errx(-1, "bad statistic %s, want min, mean or max", stat);
+  query.k = n;
+  query.top = top;
+}
+
+/* windowclose prints and frees the windows before window before. */
+void windowclose(int64_t before) {
+  struct window *w;
+  struct record **top;
+  int ntop;
+
+  while ((w = windows.open) && w->id < before) {
+    ntop = sorttable(w->t->records, w->t->nrecords, 1, &top);
+    printf("%lld ", (long long)(w->id * windows.size));
+    printtable(w->t->records, w->t->nrecords, 1, top, ntop);
+    windows.open = w->next;
+    free(w->t);
+    free(w);
+  }
+  if (before > windows.closed)
+    windows.closed = before;
+}
+
+/* windowdone is called when t is done with work item i. */
+void windowdone(struct threaddata *t, int i) {
+  int64_t horizon;
+
+  windowflush(t, -1);
+  assert(!pthread_mutex_lock(&windows.mu));
+  windows.last[i] = t->lastwindow;
+  windows.done[i] = 1;
+  for (horizon = windows.closed;
+       windows.ndone < t->nwork && windows.done[windows.ndone]; windows.ndone++)
+    if (windows.last[windows.ndone] > horizon)
+      horizon = windows.last[windows.ndone];
+  windowclose(horizon);
+  assert(!pthread_mutex_unlock(&windows.mu));
+  t->lastwindow = -1;
+}
+
+void approxstart(const char *arg) {
+  struct threaddata *t;
+  char *end;
+
+  approxk = strtol(arg, &end, 10);
+  if (*end || approxk < 1 || approxk > APPROXSIZE)
+    errx(-1, "bad count %s, want 1 to %d", arg, APPROXSIZE);
+  for (t = threaddata; t < endof(threaddata); t++)
+    assert(t->approx = calloc(1, sizeof(*t->approx)));
+}
+
+void windowsize(const char *arg) {
+  char *end;
+
+  if ((windows.size = strtoll(arg, &end, 10)) < 1 || *end)
+    errx(-1, "bad window size %s, want a positive number of seconds", arg);
+  timestamps = 1;
+}
+
+/* windowstart checks that the input can be windowed: work items must be
+ * parsed by processinput in the order of the input. */
+void windowstart(void) {
+  struct input *in;
+
+  if (!windows.size)
+    return;
+  for (in = inputlist.in; in < inputlist.in + inputlist.nin; in++)
+    if (in->format == GZIP || in->format == COLUMNAR)
+      errx(-1, "%s: -window needs text or c12z input", in->path);
+  assert(windows.last = calloc(inputlist.nwork + 1, sizeof(*windows.last)));
+  assert(windows.done = calloc(inputlist.nwork + 1, sizeof(*windows.done)));
+}
+
+int64_t workbytes(struct work *w) {
+  struct input *in;
+  int64_t bytes = 0;
+
+  if (w->in->format == BLOCKZ)
+    return ZHEADER + getle32(w->chunk + 4);
+  if (w->nin == 1)
+    return w->in->end - w->chunk < CHUNKSIZE ? w->in->end - w->chunk
+                                             : CHUNKSIZE;
+  for (in = w->in; in < w->in + w->nin; in++)
+    bytes += in->end - in->start;
+  return bytes;
+}
+
+/* sampleplan shuffles the work items and keeps the first of them. */
+void sampleplan(void) {
+  struct threaddata *t;
+  struct input *in;
+  struct work *w, tmp;
+  int i, j, n;
+
+  if (!sampling.fraction)
+    return;
+  for (in = inputlist.in; in < inputlist.in + inputlist.nin; in++)
+    if (in->format == GZIP || in->format == COLUMNAR)
+      errx(-1, "%s: -sample needs text or c12z input", in->path);
+  for (i = inputlist.nwork - 1; i > 0; i--) {
+    j = mix(sampling.seed + i) % (i + 1);
+    tmp = inputlist.work[i];
+    inputlist.work[i] = inputlist.work[j];
+    inputlist.work[j] = tmp;
+  }
+  n = ceil(sampling.fraction * inputlist.nwork);
+  for (w = inputlist.work; w < inputlist.work + inputlist.nwork; w++) {
+    sampling.bytes += workbytes(w);
+    if (w < inputlist.work + n)
+      sampling.sampledbytes += workbytes(w);
+  }
+  fprintf(stderr, "sampling %d of %d work items, %.2f%% of the input\n", n,
+          inputlist.nwork,
+          100.0 * (double)sampling.sampledbytes / (double)sampling.bytes);
+  inputlist.nwork = n;
+  for (t = threaddata; t < endof(threaddata); t++)
+    assert(t->sumsq = calloc(MAXRECORDS, sizeof(*t->sumsq)));
+}
+
+int recordptrnameasc(const void *a, const void *b) {
+  return recordnameasc(*(struct record **)a, *(struct record **)b);
+}
+
+/* approxprint prints the estimated number of stations and the approxk
+ * stations with the most rows, with bounds on their number of rows. */
+void approxprint(void) {
+  struct approx *a;
+  struct counter *merged, *m;
+  int n, i;
+
+  assert(a = malloc(sizeof(*a)));
+  merged = approxmerge(a, &n);
+  statsphase(SORT);
+  printf("about %.0f stations\n", hllestimate(a->hll));
+  for (m = merged, i = 0; m < merged + n && i < approxk; m++) {
+    if (!filterkeep(m->name, namelen(&m->r)))
+      continue;
+    fwrite(m->name, 1, namelen(&m->r), stdout);
+    printvalues(&m->r, '=');
+    printf(" (%lld to %lld rows)\n", (long long)m->r.num,
+           (long long)countof(m));
+    i++;
+  }
+  free(merged);
+  free(a);
+}
+
+/* sampleprint prints the estimates from the merged table t by name: the
+ * sample's min/mean/max, the half width of the interval of the mean and the
+ * estimated number of rows. The records are sorted through pointers so that
+ * they stay lined up with t->sumsq. */
+void sampleprint(struct threaddata *t) {
+  struct record **order, *r;
+  double scale, mean, var;
+  int i, n = 0;
+
+  scale = (double)sampling.bytes / (double)sampling.sampledbytes;
+  assert(order = malloc((t->nrecords + 1) * sizeof(*order)));
+  for (r = t->records; r < t->records + t->nrecords; r++)
+    if (filterkeep(r->fullname, namelen(r)))
+      order[n++] = r;
+  qsort(order, n, sizeof(*order), recordptrnameasc);
+  statsphase(SORT);
+
+  putchar('{');
+  for (i = 0; i < n; i++) {
+    r = order[i];
+    mean = (double)r->total / (double)r->num;
+    var = HUGE_VAL;
+    if (r->num > 1)
+      var = (t->sumsq[r - t->records] - mean * (double)r->total) /
+            (r->num - 1);
+    if (i)
+      fputs(", ", stdout);
+    fwrite(r->fullname, 1, namelen(r), stdout);
+    printvalues(r, '=');
+    printf(" +-%.*f ~%.0f", values.scale,
+           1.96 * sqrt((var > 0 ? var : 0) / r->num) / values.unit,
+           (double)r->num * scale);
+  }
+  puts("}");
+  free(order);
+}
+
+/* columnsprint prints the merged table t by name for more than one value
+ * column, as name=min/mean/max;min/mean/max... in the order of -values. The
+ * records are sorted through pointers so that they stay lined up with
+ * t->columns. */
+void columnsprint(struct threaddata *t) {
+  struct record **order, *r;
+  int i, j, n = 0;
+
+  assert(order = malloc((t->nrecords + 1) * sizeof(*order)));
+  for (r = t->records; r < t->records + t->nrecords; r++)
+    if (filterkeep(r->fullname, namelen(r)))
+      order[n++] = r;
+  qsort(order, n, sizeof(*order), recordptrnameasc);
+  statsphase(SORT);
+
+  putchar('{');
+  for (i = 0; i < n; i++) {
+    printrecord(order[i], !i);
+    for (j = 1; j < schema.nvalues; j++)
+      printvalues(valuerecord(t, order[i], j), ';');
+  }
+  puts("}");
+  free(order);
+}
+
+void *processinput(void *data) {
+  char *chunk, *chunkend;
+  struct threaddata *t = data;
+  struct work *w;
+  struct input *in;
+  struct counters c;
+  struct sample start;
+  int64_t started, bytes;
+  int i;
+
+  statsthread(&c, &start);
+  while ((i = __atomic_fetch_add(t->nextwork, 1, __ATOMIC_RELAXED)) <
+         t->nwork) {
+    started = workstart();
+    w = t->work + i;
+    in = w->in;
+    if (w->nin > 1) {
+      for (bytes = 0; in < w->in + w->nin; in++) {
+        sourceset(&t->src, in->path, in->start, in->end, 0, SOURCEFILE);
+        parselines(t, in->start, in->end);
+        bytes += in->end - in->start;
+      }
+    } else if (in->format == COLUMNAR) {
+      aggcolumns(t, in, w->chunk);
+      bytes = colblocksize(in, w->chunk);
+    } else if (in->format == BLOCKZ) {
+      bytes = unblock(t, w->chunk);
+      sourceset(&t->src, in->path, t->zbuf, t->zbuf + bytes,
+                w->chunk - (in->start - ZHEADER), SOURCEBLOCK);
+      if (bytes && !validation.on && !lastline(t->zbuf, t->zbuf + bytes))
+        badinput(&t->src, t->zbuf + bytes - 1, "missing ';'");
+      parselines(t, t->zbuf, t->zbuf + bytes);
+    } else {
+      chunk = w->chunk;
+      chunkend = chunk + CHUNKSIZE < in->end ? chunk + CHUNKSIZE : in->end;
+      if (chunk > in->start)
+        while (chunk < chunkend && chunk[-1] != '\n')
+          chunk++;
+      sourceset(&t->src, in->path, in->start, in->end, 0, SOURCEFILE);
+      parselines(t, chunk, chunkend);
+      bytes = chunkend - chunk;
+    }
+    workdone(t, started, bytes);
+    if (windows.size)
+      windowdone(t, i);
+  }
+  statsthreadend(t, &c, &start);
+
+  return 0;
+}
+
+void addinput(int fd, char *path) {
+  struct stat st;
+  struct source src;
+  struct input *in;
+  char *p;
+
+  if (fstat(fd, &st))
+    err(-1, "fstat %s", path);
+  if (!S_ISREG(st.st_mode))
+    errx(-1, "%s: not a regular file", path);
+  if (!st.st_size)
+    return;
+  if ((p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    err(-1, "mmap %s", path);
+
+  inputlist.in = grow(inputlist.in, inputlist.nin, sizeof(*inputlist.in));
+  in = inputlist.in + inputlist.nin++;
+  in->start = p;
+  in->end = p + st.st_size;
+  assert(in->path = strdup(path));
+  if (st.st_size >= ZHEADER && !memcmp(p, ZMAGIC, ZHEADER)) {
+    in->format = BLOCKZ;
+    in->start += ZHEADER;
+  } else if (st.st_size >= COLHEADER && !memcmp(p, COLMAGIC, 8)) {
+    if (approxk || validation.on || values.scale != 1 || schema.on ||
+        shared.on)
+      errx(-1, "%s: -approx, -validate, -scale, -values and -engine need text "
+               "input",
+           path);
+    in->format = COLUMNAR;
+    in->start = coldictionary(in);
+  } else if (st.st_size >= 2 && (uint8_t)p[0] == 0x1f &&
+             (uint8_t)p[1] == 0x8b) {
+    in->format = GZIP;
+  } else if (validation.on) {
+    return;
+  } else if (p[st.st_size - 1] != '\n') {
+    sourceset(&src, in->path, p, in->end, 0, SOURCEFILE);
+    badinput(&src, in->end, "missing newline at end of input");
+  } else if (!lastline(p, in->end)) {
+    sourceset(&src, in->path, p, in->end, 0, SOURCEFILE);
+    badinput(&src, in->end - 1, "missing ';'");
+  }
+}
+
+int pathasc(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+void addpath(char *path) {
+  struct stat st;
+  int fd;
+
+  if (stat(path, &st))
+    err(-1, "stat %s", path);
+  if (S_ISDIR(st.st_mode)) {
+    DIR *d;
+    struct dirent *de;
+    char **names = 0;
+    int n = 0, i;
+
+    if (!(d = opendir(path)))
+      err(-1, "opendir %s", path);
+    while ((de = readdir(d))) {
+      if (de->d_name[0] == '.')
+        continue;
+      names = grow(names, n, sizeof(*names));
+      assert(names[n] = malloc(strlen(path) + strlen(de->d_name) + 2));
+      sprintf(names[n++], "%s/%s", path, de->d_name);
+    }
+    closedir(d);
+    qsort(names, n, sizeof(*names), pathasc);
+    for (i = 0; i < n; i++) {
+      addpath(names[i]);
+      free(names[i]);
+    }
+    free(names);
+    return;
+  }
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    err(-1, "open %s", path);
+  addinput(fd, path);
+  close(fd);
+}
+
+void addwork(struct input *in, int nin, char *chunk) {
+  struct work *w;
+  inputlist.work =
+      grow(inputlist.work, inputlist.nwork, sizeof(*inputlist.work));
+  w = inputlist.work + inputlist.nwork++;
+  w->in = in;
+  w->nin = nin;
+  w->chunk = chunk;
+}
+
+int packable(struct input *in) {
+  return in->format == PLAIN && in->end - in->start < CHUNKSIZE;
+}
+
+/* Split large files into chunks and c12z files into blocks, and pack
+ * consecutive small files together until they add up to a chunk. Gzip files
+ * are not splittable; they go through readgzip instead. */
+void planwork(void) {
+  struct input *in, *pack = 0;
+  int64_t packsize = 0;
+  char *chunk;
+
+  for (in = inputlist.in; in < inputlist.in + inputlist.nin; in++) {
+    if (in->format == GZIP)
+      continue;
+    if (in->format == BLOCKZ) {
+      for (chunk = in->start; chunk < in->end;
+           chunk += ZHEADER + getle32(chunk + 4)) {
+        if (in->end - chunk < ZHEADER ||
+            in->end - chunk - ZHEADER < getle32(chunk + 4))
+          errx(-1, "%s: truncated c12z block", in->path);
+        addwork(in, 1, chunk);
+      }
+      continue;
+    }
+    if (in->format == COLUMNAR) {
+      for (chunk = in->start; chunk < in->end;
+           chunk += colblocksize(in, chunk)) {
+        if (in->end - chunk < COLBLOCKHEADER ||
+            in->end - chunk < colblocksize(in, chunk))
+          errx(-1, "%s: truncated c12c block", in->path);
+        addwork(in, 1, chunk);
+      }
+      continue;
+    }
+    if (!packable(in)) {
+      for (chunk = in->start; chunk < in->end; chunk += CHUNKSIZE)
+        addwork(in, 1, chunk);
+      continue;
+    }
+    if (pack && packsize + (in->end - in->start) > CHUNKSIZE) {
+      addwork(pack, in - pack, pack->start);
+      pack = 0;
+    }
+    if (!pack) {
+      pack = in;
+      packsize = 0;
+    }
+    packsize += in->end - in->start;
+    if (in + 1 == inputlist.in + inputlist.nin || !packable(in + 1)) {
+      addwork(pack, in + 1 - pack, pack->start);
+      pack = 0;
+    }
+  }
+}
+
+/* Push-based input. The caller owns the buffers it hands to streamfeed; the
+ * worker threads parse them in place and call release when they are done with
+ * a buffer, after which the caller may reuse it. A line that straddles two
+ * buffers is copied into carry by the feeding thread and parsed into the
+ * feeder's own threaddata, so workers only ever see complete lines. */
+struct streambuf {
+  char *start, *end, *data;
+  const char *path;
+  int64_t offset;
+  void (*release)(char *data, void *arg);
+  void *arg;
+};
+
+struct stream {
+  struct streambuf queue[2 * NTHREAD];
+  int head, tail, closed;
+  pthread_mutex_t mu;
+  pthread_cond_t nonempty, nonfull;
+  char carry[LINEMAX];
+  int ncarry;
+  /* For error messages: the input, and the bytes of it fed so far. */
+  const char *path;
+  int64_t fed;
+  struct threaddata *feeder, *workers;
+  int nworkers;
+};
+
+void *processstream(void *data) {
+  struct threaddata *t = data;
+  struct stream *s = t->stream;
+  struct streambuf b;
+  struct counters c;
+  struct sample start;
+  int64_t started;
+
+  statsthread(&c, &start);
+  for (;;) {
+    assert(!pthread_mutex_lock(&s->mu));
+    while (s->head == s->tail && !s->closed)
+      assert(!pthread_cond_wait(&s->nonempty, &s->mu));
+    if (s->head == s->tail) {
+      assert(!pthread_mutex_unlock(&s->mu));
+      break;
+    }
+    b = s->queue[s->tail++ % nelem(s->queue)];
+    assert(!pthread_cond_signal(&s->nonfull));
+    assert(!pthread_mutex_unlock(&s->mu));
+
+    started = workstart();
+    sourceset(&t->src, b.path, b.start, b.end, b.offset, SOURCESTREAM);
+    parselines(t, b.start, b.end);
+    workdone(t, started, b.end - b.start);
+    b.release(b.data, b.arg);
+  }
+  statsthreadend(t, &c, &start);
+
+  return 0;
+}
+
+void streamstart(struct stream *s, struct threaddata *feeder,
+                 struct threaddata *workers, int nworkers) {
+  struct threaddata *t;
+  memset(s, 0, sizeof(*s));
+  assert(!pthread_mutex_init(&s->mu, 0));
+  assert(!pthread_cond_init(&s->nonempty, 0));
+  assert(!pthread_cond_init(&s->nonfull, 0));
+  s->feeder = feeder;
+  s->workers = workers;
+  s->nworkers = nworkers;
+  for (t = workers; t < workers + nworkers; t++) {
+    t->stream = s;
+    assert(!pthread_create(&t->thread, 0, processstream, t));
+  }
+}
+
+void streamcarry(struct stream *s, char *p, size_t size) {
+  if (s->ncarry + size > sizeof(s->carry))
+    errx(-1, "line longer than %d bytes", (int)sizeof(s->carry));
+  memmove(s->carry + s->ncarry, p, size);
+  s->ncarry += size;
+}
+
+/* Hand data[0:size] to the stream. release(data, arg) is called exactly once,
+ * possibly from another thread and possibly before streamfeed returns. */
+void streamfeed(struct stream *s, char *data, size_t size,
+                void (*release)(char *data, void *arg), void *arg) {
+  char *first = data, *last, *end = data + size;
+  struct source *src = &s->feeder->src;
+  int64_t offset = s->fed;
+
+  s->fed += size;
+  if (s->ncarry) {
+    if (!(first = memchr(data, '\n', size))) {
+      streamcarry(s, data, size);
+      release(data, arg);
+      return;
+    }
+    first++;
+    streamcarry(s, data, first - data);
+    sourceset(src, s->path, s->carry, s->carry + s->ncarry,
+              offset + (first - data) - s->ncarry, SOURCESTREAM);
+    if (!validation.on && !lastline(s->carry, s->carry + s->ncarry))
+      badinput(src, s->carry + s->ncarry - 1, "missing ';'");
+    parselines(s->feeder, s->carry, s->carry + 1);
+    s->ncarry = 0;
+  }
+
+  for (last = end; last > first && last[-1] != '\n'; last--)
+    ;
+  if (last == first) {
+    streamcarry(s, first, end - first);
+    release(data, arg);
+    return;
+  }
+  streamcarry(s, last, end - last);
+  if (!validation.on && !lastline(first, last)) {
+    sourceset(src, s->path, first, last, offset + (first - data),
+              SOURCESTREAM);
+    badinput(src, last - 1, "missing ';'");
+  }
+
+  assert(!pthread_mutex_lock(&s->mu));
+  while (s->head - s->tail == nelem(s->queue))
+    assert(!pthread_cond_wait(&s->nonfull, &s->mu));
+  s->queue[s->head % nelem(s->queue)].start = first;
+  s->queue[s->head % nelem(s->queue)].end = last;
+  s->queue[s->head % nelem(s->queue)].data = data;
+  s->queue[s->head % nelem(s->queue)].release = release;
+  s->queue[s->head % nelem(s->queue)].arg = arg;
+  s->queue[s->head % nelem(s->queue)].path = s->path;
+  s->queue[s->head % nelem(s->queue)].offset = offset + (first - data);
+  s->head++;
+  assert(!pthread_cond_signal(&s->nonempty));
+  assert(!pthread_mutex_unlock(&s->mu));
+}
+
+/* streamend reports a last line of the input without a newline. */
+void streamend(struct stream *s) {
+  struct source *src = &s->feeder->src;
+  const char *at, *why;
+
+  if (!s->ncarry)
+    return;
+  sourceset(src, s->path, s->carry, s->carry + s->ncarry, s->fed - s->ncarry,
+            SOURCESTREAM);
+  why = checkline(src->start, src->end, &at);
+  if (validation.on)
+    validation.lines++;
+  problem(src, at, why, 0);
+  s->ncarry = 0;
+}
+
+/* Wait for all fed buffers to be parsed and released. */
+void streamfinish(struct stream *s) {
+  struct threaddata *t;
+  streamend(s);
+  assert(!pthread_mutex_lock(&s->mu));
+  s->closed = 1;
+  assert(!pthread_cond_broadcast(&s->nonempty));
+  assert(!pthread_mutex_unlock(&s->mu));
+  for (t = s->workers; t < s->workers + s->nworkers; t++)
+    assert(!pthread_join(t->thread, 0));
+}
+
+void countrelease(char *data, void *arg) { *(int *)arg += 1; }
+
+void teststream(void) {
+  char *in = "abc;1.0\ndef;-2.5\nabc;3.0\nabcdefghijklmnopqrstuvwxyz;9.9\n";
+  struct threaddata *t;
+  struct stream *s;
+  struct record *r;
+  int split, released, failed = 0, size = strlen(in);
+
+  /* Split the input in two at every possible position to cover lines that
+   * straddle buffers. */
+  for (split = 0; split <= size; split++) {
+    char *a, *b;
+    int f = 0;
+    assert(t = calloc(sizeof(*t), 2));
+    t[0].hashkey = t[1].hashkey = 111;
+    assert(s = malloc(sizeof(*s)));
+    assert(a = malloc(size));
+    memmove(a, in, size);
+    b = a + split;
+    released = 0;
+    streamstart(s, t, t + 1, 1);
+    streamfeed(s, a, split, countrelease, &released);
+    streamfeed(s, b, size - split, countrelease, &released);
+    streamfinish(s);
+    memset(a, 'x', size);
+
+    for (r = t[1].records; r < t[1].records + t[1].nrecords; r++)
+      updaterecord(upsertsz(t, r->fullname, namelen(r)), r->total, r->num,
+                   r->min, r->max);
+    if (released != 2)
+      failf(&f, "split=%d: expected 2 releases, got %d", split, released);
+    if (t->nrecords != 3)
+      failf(&f, "split=%d: expected 3 records, got %d", split, t->nrecords);
+    r = upsertstr(t, "abc;");
+    if (r->num != 2 || r->total != 40 || r->min != 10 || r->max != 30)
+      failf(&f, "split=%d: bad abc record", split);
+    r = upsertstr(t, "abcdefghijklmnopqrstuvwxyz;");
+    if (r->num != 1 || r->total != 99)
+      failf(&f, "split=%d: bad long record", split);
+    failed += !!f;
+    free(a);
+    free(s);
+    free(t);
+  }
+  if (failed)
+    warnx("teststream: %d/%d tests failed", failed, size + 1);
+  else
+    warnx("teststream: %d tests ok", size + 1);
+}
+
+/* Buffers for reading from a pipe. Released buffers go back on the free list
+ * so we do not have to allocate while streaming. */
+struct bufpool {
+  char *free[3 * NTHREAD];
+  int nfree;
+  pthread_mutex_t mu;
+  pthread_cond_t nonempty;
+} bufpool = {{0}, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+char *bufget(void) {
+  char *buf;
+  assert(!pthread_mutex_lock(&bufpool.mu));
+  while (!bufpool.nfree)
+    assert(!pthread_cond_wait(&bufpool.nonempty, &bufpool.mu));
+  buf = bufpool.free[--bufpool.nfree];
+  assert(!pthread_mutex_unlock(&bufpool.mu));
+  return buf;
+}
+
+void bufput(char *buf, void *arg) {
+  assert(!pthread_mutex_lock(&bufpool.mu));
+  assert(bufpool.nfree < nelem(bufpool.free));
+  bufpool.free[bufpool.nfree++] = buf;
+  assert(!pthread_cond_signal(&bufpool.nonempty));
+  assert(!pthread_mutex_unlock(&bufpool.mu));
+}
+
+/* Start a stream that is fed by the main thread, which parses straddling
+ * lines into threaddata[0], and parsed by all other threads. */
+struct stream *streamopen(void) {
+  struct stream *s;
+
+  if (!bufpool.nfree)
+    while (bufpool.nfree < nelem(bufpool.free))
+      assert(bufpool.free[bufpool.nfree++] = malloc(CHUNKSIZE));
+  assert(s = malloc(sizeof(*s)));
+  streamstart(s, threaddata, threaddata + 1, nelem(threaddata) - 1);
+  return s;
+}
+
+void streamclose(struct stream *s) {
+  streamfinish(s);
+  free(s);
+}
+
+void readstream(struct stream *s, int fd) {
+  s->path = "stdin";
+  s->fed = 0;
+  for (;;) {
+    char *buf = bufget();
+    ssize_t n, size = 0;
+    while (size < CHUNKSIZE && (n = read(fd, buf + size, CHUNKSIZE - size)))
+      if (n < 0)
+        err(-1, "read");
+      else
+        size += n;
+    if (!size) {
+      bufput(buf, 0);
+      break;
+    }
+    streamfeed(s, buf, size, bufput, 0);
+  }
+}
+
+/* Gzip has no block index so decompression is serial, but the decompressed
+ * buffers are parsed in parallel by the stream workers. Concatenated gzip
+ * members, as written by pigz or bgzip, are decompressed one after another. */
+void readgzip(struct stream *s, struct input *in) {
+#if HAVE_ZLIB
+  z_stream z;
+  int ret = Z_OK;
+  char *buf;
+
+  s->path = in->path;
+  s->fed = 0;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 15 + 32) != Z_OK)
+    errx(-1, "%s: inflateInit2 failed", in->path);
+  z.next_in = (Bytef *)in->start;
+  z.avail_in = in->end - in->start;
+  while (ret != Z_STREAM_END || z.avail_in) {
+    if (ret == Z_STREAM_END && inflateReset(&z) != Z_OK)
+      errx(-1, "%s: inflateReset failed", in->path);
+    buf = bufget();
+    z.next_out = (Bytef *)buf;
+    z.avail_out = CHUNKSIZE;
+    ret = inflate(&z, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END)
+      errx(-1, "%s: inflate: %s", in->path, z.msg ? z.msg : "error");
+    if (ret == Z_OK && z.avail_out && !z.avail_in)
+      errx(-1, "%s: truncated gzip stream", in->path);
+    streamfeed(s, buf, CHUNKSIZE - z.avail_out, bufput, 0);
+  }
+  inflateEnd(&z);
+  streamend(s);
+#else
+  errx(-1, "%s: gzip input needs a c12 built with zlib", in->path);
+#endif
+}
+
+/* -groups FILE rolls the stations up into groups at one or more levels, such
+ * as region and country. Each line of FILE is a station followed by its group
+ * at each level, separated by ';' like data/weather_stations.csv, and lines
+ * starting with '#' are comments. Groups are numbered when FILE is loaded and
+ * each station maps to its group numbers, so the rollup after the merge is
+ * one lookup per station and not per row. Stations that are not in FILE are
+ * in no group. */
+struct level {
+  struct record *groups, **top;
+  int ngroups, ntop, *index;
+  const char **set;
+};
+
+struct rollup {
+  int nlevels, exp, *group;
+  struct level *levels;
+  const char **stations;
+} rollup;
+
+/* rollupfield returns the length of the field at p, which ends in ';'. */
+int rollupfield(const char *path, int line, const char *p) {
+  int size = strchr(p, ';') - p;
+  if (size > NAMEMAX)
+    errx(-1, "%s:%d: name longer than %d bytes", path, line, NAMEMAX);
+  return size;
+}
+
+void rollupload(const char *path) {
+  char *data, *p, *q, *s, *end;
+  const char **sp;
+  struct level *l;
+  int n, line, size, *group;
+
+  if (rollup.nlevels)
+    errx(-1, "-groups can only be given once");
+  data = readall(path, &end);
+  for (n = 0, p = data; p < end; p++)
+    n += *p == '\n';
+  for (rollup.exp = 4; 1 << rollup.exp < 2 * n; rollup.exp++)
+    ;
+  assert(rollup.stations = calloc(1 << rollup.exp, sizeof(*rollup.stations)));
+
+  for (p = data, line = 1; p < end; p = q + 1, line++) {
+    q = memchr(p, '\n', end - p);
+    *q = ';';
+    if (q == p || *p == '#')
+      continue;
+    for (n = -1, s = p; s <= q; s++)
+      n += *s == ';';
+    if (!rollup.nlevels) {
+      if (n < 1)
+        errx(-1, "%s:%d: expected a station and its groups", path, line);
+      rollup.nlevels = n;
+      assert(rollup.levels = calloc(n, sizeof(*rollup.levels)));
+      assert(rollup.group = malloc(n * sizeof(int) << rollup.exp));
+      for (l = rollup.levels; l < rollup.levels + n; l++) {
+        assert(l->set = calloc(1 << rollup.exp, sizeof(*l->set)));
+        assert(l->index = malloc(sizeof(*l->index) << rollup.exp));
+      }
+    }
+    if (n != rollup.nlevels)
+      errx(-1, "%s:%d: expected %d groups, got %d", path, line, rollup.nlevels,
+           n);
+
+    size = rollupfield(path, line, p);
+    sp = setfind(rollup.stations, rollup.exp, p, size,
+                 mix(hashsz(FILTERKEY, p, size)));
+    if (*sp)
+      errx(-1, "%s:%d: duplicate station", path, line);
+    *sp = p;
+    group = rollup.group + (sp - rollup.stations) * rollup.nlevels;
+    for (l = rollup.levels; l < rollup.levels + rollup.nlevels; l++) {
+      p += size + 1;
+      size = rollupfield(path, line, p);
+      sp = setfind(l->set, rollup.exp, p, size,
+                   mix(hashsz(FILTERKEY, p, size)));
+      if (!*sp) {
+        *sp = p;
+        l->groups = grow(l->groups, l->ngroups, sizeof(*l->groups));
+        memset(l->groups + l->ngroups, 0, sizeof(*l->groups));
+        l->groups[l->ngroups].fullname = p;
+        l->index[sp - l->set] = l->ngroups++;
+      }
+      *group++ = l->index[sp - l->set];
+    }
+  }
+  if (!rollup.nlevels)
+    errx(-1, "%s: no stations", path);
+}
+
+/* rollupstation adds station r to its groups. */
+void rollupstation(const struct record *r) {
+  const char **sp;
+  int i, size = namelen(r), *group;
+
+  if (!filterkeep(r->fullname, size))
+    return;
+  sp = setfind(rollup.stations, rollup.exp, r->fullname, size,
+               mix(hashsz(FILTERKEY, r->fullname, size)));
+  if (!*sp)
+    return;
+  group = rollup.group + (sp - rollup.stations) * rollup.nlevels;
+  for (i = 0; i < rollup.nlevels; i++)
+    updaterecord(rollup.levels[i].groups + group[i], r->total, r->num, r->min,
+                 r->max);
+}
+
+void rollupstations(struct record *records, int nrecords) {
+  struct record *r;
+  for (r = records; rollup.nlevels && r < records + nrecords; r++)
+    rollupstation(r);
+}
+
+/* rollupcompact drops the groups without any rows once all stations have
+ * been added, which renumbers the rest, and puts each level in output
+ * order. */
+void rollupcompact(void) {
+  struct record *r;
+  struct level *l;
+  int i;
+
+  for (l = rollup.levels; l < rollup.levels + rollup.nlevels; l++) {
+    for (i = 0, r = l->groups; r < l->groups + l->ngroups; r++)
+      if (r->num)
+        l->groups[i++] = *r;
+    l->ngroups = i;
+    l->ntop = sorttable(l->groups, l->ngroups, 0, &l->top);
+  }
+}
+
+/* The runs are merged through a heap of cursors ordered by the name of their
+ * current record. A cursor reads its run with pread, so that runs in the same
+ * file do not share a file offset. If there are more runs than SPILLFANIN,
+ * groups of SPILLFANIN runs are first merged into longer runs. */
+#define SPILLBUF (1 << 16)
+#define SPILLFANIN 256
+
+struct cursor {
+  struct run run;
+  char *p, *end, buf[SPILLBUF], name[NAMEMAX + 1];
+  struct record r;
+};
+
+int cursornext(struct cursor *c) {
+  int64_t n;
+  int size;
+
+  if (c->end - c->p < SPILLENTRYMAX && c->run.start < c->run.end) {
+    n = c->end - c->p;
+    memmove(c->buf, c->p, n);
+    c->p = c->buf;
+    c->end = c->buf + n;
+    n = endof(c->buf) - c->end;
+    if (n > c->run.end - c->run.start)
+      n = c->run.end - c->run.start;
+    if ((n = pread(c->run.fd, c->end, n, c->run.start)) <= 0)
+      err(-1, "read spill file");
+    c->end += n;
+    c->run.start += n;
+  }
+  if (c->p == c->end)
+    return 0;
+  memmove(&c->r.total, c->p, 8);
+  memmove(&c->r.num, c->p + 8, 4);
+  memmove(&c->r.min, c->p + 12, 4);
+  memmove(&c->r.max, c->p + 16, 4);
+  size = (uint8_t)c->p[20];
+  memmove(c->name, c->p + 21, size);
+  c->name[size] = ';';
+  c->r.fullname = c->name;
+  c->p += 21 + size;
+  return 1;
+}
+
+int samename(const struct record *a, const struct record *b) {
+  int size = namelen(a);
+  return size == namelen(b) && !memcmp(a->fullname, b->fullname, size);
+}
+
+void cursorsift(struct cursor **h, int n, int i) {
+  struct cursor *c;
+  int j;
+
+  while ((j = 2 * i + 1) < n) {
+    if (j + 1 < n && recordnameasc(&h[j + 1]->r, &h[j]->r) < 0)
+      j++;
+    if (recordnameasc(&h[j]->r, &h[i]->r) > 0)
+      break;
+    c = h[i], h[i] = h[j], h[j] = c;
+    i = j;
+  }
+}
+
+/* spillemit writes a merged record to out, or if out is 0 it prints it. */
+void spillemit(struct record *r, FILE *out, int *first) {
+  if (out) {
+    spillwrite(out, r);
+    return;
+  }
+  spill.rows += r->num;
+  if (rollup.nlevels)
+    rollupstation(r);
+  if (filterkeep(r->fullname, namelen(r)))
+    printrecord(r, *first), *first = 0;
+}
+
+/* spillmerge merges the sorted runs, adding up the records of a station. */
+void spillmerge(struct run *runs, int nruns, FILE *out) {
+  struct cursor *cursors, **h, *c;
+  struct record sum;
+  char name[NAMEMAX + 1];
+  int i, n = 0, first = 1;
+
+  assert(cursors = malloc(nruns * sizeof(*cursors)));
+  assert(h = malloc(nruns * sizeof(*h)));
+  for (c = cursors; c < cursors + nruns; c++) {
+    c->run = runs[c - cursors];
+    c->p = c->end = c->buf;
+    if (cursornext(c))
+      h[n++] = c;
+  }
+  for (i = n / 2 - 1; i >= 0; i--)
+    cursorsift(h, n, i);
+  memset(&sum, 0, sizeof(sum));
+  while (n) {
+    c = h[0];
+    if (!sum.num || !samename(&sum, &c->r)) {
+      if (sum.num)
+        spillemit(&sum, out, &first);
+      memset(&sum, 0, sizeof(sum));
+      memmove(name, c->name, namelen(&c->r) + 1);
+      sum.fullname = name;
+    }
+    updaterecord(&sum, c->r.total, c->r.num, c->r.min, c->r.max);
+    if (!cursornext(c))
+      h[0] = h[--n];
+    cursorsift(h, n, 0);
+  }
+  if (sum.num)
+    spillemit(&sum, out, &first);
+  free(h);
+  free(cursors);
+}
+
+/* spillprint merges all runs into the output. */
+void spillprint(void) {
+  struct threaddata *t;
+  FILE *f = 0;
+  int64_t start;
+  int i;
+
+  for (t = threaddata; t < endof(threaddata); t++)
+    if (t->spillfile && fflush(t->spillfile))
+      err(-1, "write spill file");
+  for (i = 0; spill.nruns - i > SPILLFANIN; i += SPILLFANIN) {
+    if (!f)
+      f = spillopen();
+    start = ftello(f);
+    spillmerge(spill.runs + i, SPILLFANIN, f);
+    if (fflush(f))
+      err(-1, "write spill file");
+    spilladd(f, start);
+  }
+  statsphase(SORT);
+  putchar('{');
+  spillmerge(spill.runs + i, spill.nruns - i, 0);
+  puts("}");
+}
+
+/* spillstart lets the thread tables spill, except for the modes that keep
+ * other state per record or per table. */
+void spillstart(void) {
+  struct threaddata *t;
+
+  if (approxk || sampling.fraction || windows.size || schema.nvalues > 1 ||
+      shared.on)
+    return;
+  if (!(spill.dir = getenv("TMPDIR")))
+    spill.dir = "/tmp";
+  for (t = threaddata; t < endof(threaddata); t++)
+    t->spill = 1;
+}
+
+/* -mem MB limits the stations of all thread tables together to about MB
+ * megabytes, counting a record, its name and its index slots. */
+void spilllimit(const char *arg) {
+  char *end;
+  long mb = strtol(arg, &end, 10);
+  int64_t n;
+
+  if (*end || mb < 1)
+    errx(-1, "bad memory budget %s, want megabytes", arg);
+  n = ((int64_t)mb << 20) / NTHREAD /
+      (sizeof(struct record) + NAMEMAX + 1 + 4 * sizeof(struct record *));
+  spill.limit = n < 1 ? 1 : n < MAXRECORDS ? n : MAXRECORDS;
+}
+
+void *testsharedthread(void *data) {
+  struct threaddata *t = data;
+  parselines(t, (char *)t->src.start, (char *)t->src.end);
+  return 0;
+}
+
+/* Parse the same 2000 stations into the shared table from all threads at
+ * once. Every station must come out once, with the rows of all threads. */
+void testshared(void) {
+  struct threaddata *t;
+  struct record *r;
+  char *in, *p;
+  int i, v, f = 0;
+
+  assert(p = in = malloc(2000 * 32));
+  for (i = 0; i < 2000; i++)
+    p += sprintf(p, "s%d;%d.%d\ns%d;%d.%d\n", i, i % 100 / 10, i % 10, i,
+                 (i % 100 + 1) / 10, (i % 100 + 1) % 10);
+  shared.on = 1;
+  sharedstart(111);
+  for (t = threaddata; t < endof(threaddata); t++) {
+    sourceset(&t->src, "test", in, p, 0, SOURCEFILE);
+    assert(!pthread_create(&t->thread, 0, testsharedthread, t));
+  }
+  for (t = threaddata; t < endof(threaddata); t++)
+    assert(!pthread_join(t->thread, 0));
+  sharedcompact();
+  if (shared.nrecords != 2000)
+    failf(&f, "testshared: %d stations, want 2000", shared.nrecords);
+  for (r = shared.records; r < shared.records + shared.nrecords; r++) {
+    v = atoi(r->fullname + 1) % 100;
+    if (r->num != 2 * NTHREAD || r->min != v || r->max != v + 1 ||
+        r->total != NTHREAD * (2 * v + 1))
+      failf(&f, "testshared: %.*s is wrong", namelen(r), r->fullname);
+  }
+  free(shared.index);
+  free(shared.records);
+  free(shared.names);
+  memset(&shared, 0, sizeof(shared));
+  for (t = threaddata; t < endof(threaddata); t++)
+    t->spare = t->nrows = 0;
+  free(in);
+  if (f)
+    warnx("testshared: %d tests failed", f);
+  else
+    warnx("testshared: 2000 stations ok");
+}
+
+/* Spill a table of 1000 stations 100 at a time, twice over, merge the runs
+ * into one and read it back. */
+void testspill(void) {
+  struct threaddata *t, *u;
+  struct cursor *c;
+  struct record prev;
+  char name[16], prevname[16];
+  FILE *f;
+  int i, n = 0, fails = 0;
+
+  assert(t = calloc(sizeof(*t), 1));
+  assert(c = malloc(sizeof(*c)));
+  t->hashkey = 111;
+  t->spill = 1;
+  spillstart();
+  spill.limit = 100;
+  for (i = 0; i < 2000; i++) {
+    sprintf(name, "s%d;", i * 7 % 1000);
+    updaterecord(upsertstr(t, name), i, 1, i, i);
+  }
+  spillrun(t);
+  if (fflush(t->spillfile))
+    err(-1, "write spill file");
+  f = spillopen();
+  spillmerge(spill.runs, spill.nruns, f);
+  if (fflush(f))
+    err(-1, "write spill file");
+  c->run.fd = fileno(f);
+  c->run.start = 0;
+  c->run.end = ftello(f);
+  c->p = c->end = c->buf;
+  prev.fullname = prevname;
+  for (; cursornext(c); n++) {
+    if (n && recordnameasc(&prev, &c->r) > 0)
+      failf(&fails, "%.*s after %.*s", namelen(&c->r), c->name,
+            namelen(&prev), prevname);
+    if (c->r.num != 2 || c->r.max - c->r.min != 1000)
+      failf(&fails, "%.*s: num %d, min %d, max %d", namelen(&c->r), c->name,
+            c->r.num, c->r.min, c->r.max);
+    memmove(prevname, c->name, sizeof(prevname));
+  }
+  if (n != 1000)
+    failf(&fails, "%d stations after merging, want 1000", n);
+  if (fails)
+    warnx("testspill: %d tests failed", fails);
+  else
+    warnx("testspill: %d stations ok", n);
+  fclose(f);
+  fclose(t->spillfile);
+  for (u = threaddata; u < endof(threaddata); u++)
+    u->spill = 0;
+  spill.limit = MAXRECORDS;
+  spill.nruns = 0;
+  free(c);
+  free(t);
+}
+
+/* Check topk against a full sort for every statistic and direction, on
+ * enough records to split the selection across threads. Values repeat so
+ * that ties are broken by name. */
+void testtopk(void) {
+  struct threaddata *t;
+  struct record **all, **top;
+  int ks[] = {1, 5, 100, MAXRECORDS}, *k, n, i, f = 0, ntests = 0;
+  uint32_t state = 1;
+  char name[16];
+
+  assert(t = calloc(sizeof(*t), 1));
+  t->hashkey = 111;
+  for (i = 0; i < 10000; i++) {
+    int x = benchrandom(&state) % 200 - 100;
+    sprintf(name, "s%d;", i);
+    updaterecord(upsertstr(t, name), x, 1, x, x);
+    updaterecord(upsertstr(t, name), 2 * x, 1, 2 * x, 2 * x);
+  }
+  assert(all = malloc(t->nrecords * sizeof(*all)));
+  assert(top = malloc(MAXRECORDS * sizeof(*top)));
+  for (query.by = 0; query.by < nelem(statname); query.by++)
+    for (query.top = 0; query.top < 2; query.top++)
+      for (k = ks; k < endof(ks); k++, ntests++) {
+        for (i = 0; i < t->nrecords; i++)
+          all[i] = t->records + i;
+        qsort(all, t->nrecords, sizeof(*all), recordrank);
+        query.k = *k;
+        n = topk(t->records, t->nrecords, 0, top);
+        if (n != (*k < t->nrecords ? *k : t->nrecords))
+          failf(&f, "%s %d %s: got %d records", query.top ? "top" : "bottom",
+                *k, statname[query.by], n);
+        else if (memcmp(top, all, n * sizeof(*top)))
+          failf(&f, "%s %d %s: wrong records", query.top ? "top" : "bottom",
+                *k, statname[query.by]);
+      }
+  memset(&query, 0, sizeof(query));
+  if (f)
+    warnx("testtopk: %d/%d tests failed", f, ntests);
+  else
+    warnx("testtopk: %d tests ok", ntests);
+  free(all);
+  free(top);
+  free(t);
+}
+
+/* validatereport prints the problems that -validate kept, counting the lines
+ * of text files up to each of them, and exits if there were any. */
+void validatereport(void) {
+  struct problem *p;
+  const char *line, *counted = 0;
+  char where[PATH_MAX + 64];
+  int64_t n = 1;
+
+  for (p = validation.problems;
+       p < validation.problems + validation.nproblems; p++) {
+    if (p->src.kind == SOURCEFILE) {
+      if (p == validation.problems || p[-1].src.start != p->src.start)
+        counted = p->src.start, n = 1;
+      for (line = p->at; line > p->src.start && line[-1] != '\n'; line--)
+        ;
+      n += countlines(counted, line);
+      counted = line;
+    }
+    sourceline(where, sizeof(where), &p->src, p->at,
+               p->src.kind == SOURCEFILE ? n : p->line);
+    warnx("%s: %s", where, p->why);
+  }
+  if (validation.bad)
+    errx(-1, "%lld of %lld lines malformed", (long long)validation.bad,
+         (long long)validation.lines);
+}
+
+void usage(void) {
+  /* Two strings because C90 compilers need not support longer ones. */
+  errx(-1, "%s%s",
+       "Usage: c12 [-test|-bench|-compress|-columnar]\n"
+       "       c12 [-stats] [-trace FILE] [-stations FILE|-exclude FILE]\n"
+       "           [-groups FILE] [-window SECONDS] [-approx K]\n"
+       "           [-sample FRACTION [-seed SEED]] [-mem MB] [-scale N]\n"
+       "           [-delimiter C] [-key N] [-values N[,N...]]\n"
+       "           [-engine local|shared]\n",
+       "           [-top K STAT|-bottom K STAT]\n"
+       "           [FILE|DIR...]\n"
+       "       c12 -validate [-window SECONDS] [-scale N] [-delimiter C]\n"
+       "           [-key N] [-values N[,N...]] [FILE|DIR...]\n"
+       "STAT is one of min, mean and max.");
+}
+
+int main(int argc, char **argv) {
+  struct record *r, *records, **top;
+  struct level *l;
+  struct stat st;
+  struct threaddata *t, *t0 = threaddata;
+  struct input *in;
+  struct stream *s = 0;
+  struct timespec now;
+  int i, ntop, nrecords, nextwork = 0;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  for (t = threaddata; t < endof(threaddata); t++) {
+    t->hashkey = mix(now.tv_sec ^ (uint64_t)now.tv_nsec << 32 ^ getpid()) | 1;
+    t->window = t->lastwindow = -1;
+  }
+
+  if (argc == 2 && !strcmp("-test", argv[1])) {
+    testparsenum();
+    testcheckline();
+    testschema();
+    testupsert();
+    testrehash();
+    teststream();
+    testblock();
+    testtopk();
+    testparseepoch();
+    testapprox();
+    testspill();
+    testshared();
+    return 0;
+  } else if (argc == 2 && !strcmp("-bench", argv[1])) {
+    bench();
+    return 0;
+  } else if (argc == 2 && !strcmp("-compress", argv[1])) {
+    compressinput(0);
+    return 0;
+  } else if (argc == 2 && !strcmp("-columnar", argv[1])) {
+    columnarinput(0);
+    return 0;
+  }
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    if (!strcmp("-stats", argv[i]))
+      stats = 1;
+    else if (!strcmp("-validate", argv[i]))
+      validation.on = 1;
+    else if (!strcmp("-trace", argv[i]) && i + 1 < argc)
+      tracepath = argv[++i];
+    else if (!strcmp("-stations", argv[i]) && i + 1 < argc)
+      filterload(argv[++i], 0);
+    else if (!strcmp("-exclude", argv[i]) && i + 1 < argc)
+      filterload(argv[++i], 1);
+    else if (!strcmp("-groups", argv[i]) && i + 1 < argc)
+      rollupload(argv[++i]);
+    else if (!strcmp("-approx", argv[i]) && i + 1 < argc)
+      approxstart(argv[++i]);
+    else if (!strcmp("-sample", argv[i]) && i + 1 < argc)
+      sampleoption(argv[++i]);
+    else if (!strcmp("-seed", argv[i]) && i + 1 < argc)
+      sampling.seed = strtoull(argv[++i], 0, 10);
+    else if (!strcmp("-scale", argv[i]) && i + 1 < argc)
+      scaleoption(argv[++i]);
+    else if (!strcmp("-delimiter", argv[i]) && i + 1 < argc)
+      delimiteroption(argv[++i]);
+    else if (!strcmp("-key", argv[i]) && i + 1 < argc)
+      keyoption(argv[++i]);
+    else if (!strcmp("-values", argv[i]) && i + 1 < argc)
+      valuesoption(argv[++i]);
+    else if (!strcmp("-engine", argv[i]) && i + 1 < argc)
+      engineoption(argv[++i]);
+    else if (!strcmp("-mem", argv[i]) && i + 1 < argc)
+      spilllimit(argv[++i]);
+    else if (!strcmp("-window", argv[i]) && i + 1 < argc)
+      windowsize(argv[++i]);
+    else if (!strcmp("-top", argv[i]) && i + 2 < argc)
+      parsequery(1, argv[i + 1], argv[i + 2]), i += 2;
+    else if (!strcmp("-bottom", argv[i]) && i + 2 < argc)
+      parsequery(0, argv[i + 1], argv[i + 2]), i += 2;
+    else
+      usage();
+  argc -= i - 1;
+  argv += i - 1;
+  timing = stats || tracepath;
+  schemastart();
+  if (schema.on && (windows.size || approxk || sampling.fraction))
+    errx(-1, "-delimiter, -key and -values cannot be combined with -window, "
+             "-approx or -sample");
+  if (shared.on && (schema.on || windows.size || approxk || sampling.fraction))
+    errx(-1, "-engine shared cannot be combined with -delimiter, -key, "
+             "-values, -window, -approx or -sample");
+  if (shared.on)
+    sharedstart(t0->hashkey);
+  if (schema.nvalues > 1 && (rollup.nlevels || query.k))
+    errx(-1, "more than one value column cannot be combined with -groups or "
+             "-top");
+  if (windows.size && rollup.nlevels)
+    errx(-1, "-window and -groups cannot be combined");
+  if (validation.on && (approxk || sampling.fraction || rollup.nlevels ||
+                        query.k))
+    errx(-1, "-validate cannot be combined with -approx, -sample, -groups or "
+             "-top");
+  if (validation.on)
+    windows.size = 0; /* only to check the timestamps */
+  if (approxk && (windows.size || rollup.nlevels || query.k))
+    errx(-1, "-approx cannot be combined with -window, -groups or -top");
+  if (sampling.fraction && (approxk || windows.size || rollup.nlevels ||
+                            query.k))
+    errx(-1, "-sample cannot be combined with -approx, -window, -groups or "
+             "-top");
+
+  spillstart();
+  statsbegin();
+  if (argc > 1) {
+    for (i = 1; i < argc; i++)
+      addpath(argv[i]);
+  } else {
+    if (fstat(0, &st))
+      err(-1, "fstat stdin");
+    if (S_ISREG(st.st_mode))
+      addinput(0, "stdin");
+  }
+
+  if (argc > 1 || S_ISREG(st.st_mode)) {
+    planwork();
+    windowstart();
+    sampleplan();
+    statsphase(MAP);
+    for (t = threaddata; t < endof(threaddata); t++) {
+      t->work = inputlist.work;
+      t->nwork = inputlist.nwork;
+      t->nextwork = &nextwork;
+      assert(!pthread_create(&t->thread, 0, processinput, t));
+    }
+    for (t = threaddata; t < endof(threaddata); t++)
+      assert(!pthread_join(t->thread, 0));
+    for (in = inputlist.in; in < inputlist.in + inputlist.nin; in++)
+      if (in->format == GZIP)
+        readgzip(s ? s : (s = streamopen()), in);
+  } else {
+    if (windows.size || sampling.fraction)
+      errx(-1, "-window and -sample need files and not a pipe");
+    statsphase(MAP);
+    readstream(s = streamopen(), 0);
+  }
+  if (s)
+    streamclose(s);
+  statsphase(PARSE);
+  printhtstats();
+
+  for (t = threaddata + 1; t < endof(threaddata); t++)
+    for (r = t->records; r < t->records + t->nrecords; r++) {
+      struct record *u = upsertsz(t0, r->fullname, namelen(r));
+      updaterecord(u, r->total, r->num, r->min, r->max);
+      if (t->sumsq)
+        t0->sumsq[u - t0->records] += t->sumsq[r - t->records];
+      for (i = 1; i < schema.nvalues; i++) {
+        struct record *c = valuerecord(t, r, i);
+        updaterecord(valuerecord(t0, u, i), c->total, c->num, c->min, c->max);
+      }
+    }
+  for (t = threaddata; t < endof(threaddata) && inputlist.nin; t++)
+    for (in = inputlist.in; t->col && in < inputlist.in + inputlist.nin; in++)
+      mergecolumns(t0, t->col[in - inputlist.in], in);
+  if (spill.nruns && query.k)
+    errx(-1, "-top and -bottom need all stations in memory, %d per thread",
+         spill.limit);
+  if (spill.nruns && t0->nrecords)
+    spillrun(t0);
+  if (shared.on) {
+    sharedcompact();
+    records = shared.records;
+    nrecords = shared.nrecords;
+  } else {
+    records = t0->records;
+    nrecords = t0->nrecords;
+  }
+  rollupstations(records, nrecords);
+  statsphase(MERGE);
+
+  /* Spilled stations only reach their groups in the merge of spillprint. */
+  if (!spill.nruns)
+    rollupcompact();
+  if (validation.on) {
+    statsphase(SORT);
+    validatereport();
+  } else if (approxk) {
+    approxprint();
+  } else if (sampling.fraction) {
+    sampleprint(t0);
+  } else if (schema.nvalues > 1) {
+    columnsprint(t0);
+  } else if (windows.size) {
+    statsphase(SORT);
+    windowclose(INT64_MAX);
+  } else if (spill.nruns) {
+    spillprint();
+    rollupcompact();
+  } else {
+    /* This qsort will invalidate recordindex but that is OK because we don't
+     * need recordindex anymore. */
+    ntop = sorttable(records, nrecords, 1, &top);
+    statsphase(SORT);
+    printtable(records, nrecords, 1, top, ntop);
+  }
+  for (l = rollup.levels; l < rollup.levels + rollup.nlevels; l++)
+    printtable(l->groups, l->ngroups, 0, l->top, l->ntop);
+  fflush(stdout);
+  statsphase(OUTPUT);
+  printstats(t0);
+  writetrace();
+
+  return 0;
+}
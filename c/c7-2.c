@@ -168,7 +168,7 @@ void *processinput(void *data) {
          chunk < t->end) {
     chunkend = chunk + CHUNKSIZE > t->end ? t->end : chunk + CHUNKSIZE;
     if (chunk > t->start) {
-      chunk = memchr(chunk, '\n', chunkend - chunk);
+      chunk = memchr(chunk - 1, '\n', chunkend - chunk + 1);
       assert(chunk);
       chunk++;
     }
@@ -50,7 +50,7 @@ void testpacksigned(void) {
       int ok = (i == unpacked) && !((packed >> shift) & ~((1 << bits) - 1));
       if (0)
         printf("test1: i=%d shift=%d packed=%#llx unpacked=%lld ok=%d\n", i,
-               shift, packed, unpacked, ok);
+               shift, (unsigned long long)packed, (long long)unpacked, ok);
       fail += !ok;
     }
 
@@ -86,7 +86,7 @@ int64_t Recordtotal(struct Record *r) {
   return unpacksigned(r->packed, TOTALBITS, 0);
 }
 void Recordsettotal(struct Record *r, int64_t total) {
-  uint64_t mask = (1ULL << (1 + TOTALBITS)) - 1;
+  uint64_t mask = (1ULL << TOTALBITS) - 1;
   r->packed = (r->packed & ~mask) | (packsigned(total, TOTALBITS, 0) & mask);
 }
 
@@ -96,7 +96,7 @@ int16_t Recordmin(struct Record *r) {
 }
 void Recordsetmin(struct Record *r, int16_t min) {
   int shift = TOTALBITS;
-  uint64_t mask = ((1ULL << (1 + MINBITS)) - 1) << shift;
+  uint64_t mask = ((1ULL << MINBITS) - 1) << shift;
   r->packed = (r->packed & ~mask) | ((packsigned(min, MINBITS, shift)) & mask);
 }
 
@@ -106,7 +106,7 @@ int16_t Recordmax(struct Record *r) {
 }
 void Recordsetmax(struct Record *r, int16_t max) {
   int shift = TOTALBITS + MINBITS;
-  uint64_t mask = ((1ULL << (1 + MAXBITS)) - 1) << shift;
+  uint64_t mask = ((1ULL << MAXBITS) - 1) << shift;
   r->packed = (r->packed & ~mask) | ((packsigned(max, MAXBITS, shift)) & mask);
 }
 
@@ -125,15 +125,18 @@ void testRecord(void) {
     int ok;
     Recordsettotal(&r, t->total);
     Recordsetmin(&r, t->min);
-    printf("r.packed=%#llx total=%lld r.min=%d\n", r.packed, Recordtotal(&r),
+    printf("r.packed=%#llx total=%lld r.min=%d\n",
+           (unsigned long long)r.packed, (long long)Recordtotal(&r),
            Recordmin(&r));
     Recordsetmax(&r, t->max);
-    printf("r.packed=%#llx total=%lld r.min=%d r.max=%d\n", r.packed,
-           Recordtotal(&r), Recordmin(&r), Recordmax(&r));
+    printf("r.packed=%#llx total=%lld r.min=%d r.max=%d\n",
+           (unsigned long long)r.packed, (long long)Recordtotal(&r),
+           Recordmin(&r), Recordmax(&r));
     ok = Recordtotal(&r) == t->total && Recordmin(&r) == t->min &&
          Recordmax(&r) == t->max;
     if (!ok)
-      printf("i=%ld fail: r.packed=%#llx\n", t - tests, r.packed);
+      printf("i=%ld fail: r.packed=%#llx\n", t - tests,
+             (unsigned long long)r.packed);
     fail += !ok;
   }
   if (fail)
@@ -155,16 +158,15 @@ char *namealloc(struct threaddata *t, int size) {
 }
 
 int recordnameasc(const void *a_, const void *b_) {
-  const struct Record *a = a_, *b = b_;
-  char *aname = Recordname(threaddata, a), *bname = Recordname(threaddata, b);
-  if (!aname && !bname)
+  struct Record *a = (struct Record *)a_, *b = (struct Record *)b_;
+  if (!Recordnamepresent(a) && !Recordnamepresent(b))
     return 0;
-  else if (!aname)
+  else if (!Recordnamepresent(a))
     return 1;
-  else if (!bname)
+  else if (!Recordnamepresent(b))
     return -1;
   else
-    return strcmp(aname, bname);
+    return strcmp(Recordname(threaddata, a), Recordname(threaddata, b));
 }
 
 /* From https://nullprogram.com/blog/2022/08/08/ */
@@ -272,7 +274,7 @@ void *processinput(void *data) {
          chunk < t->end) {
     chunkend = chunk + CHUNKSIZE > t->end ? t->end : chunk + CHUNKSIZE;
     if (chunk > t->start) {
-      chunk = memchr(chunk, '\n', chunkend - chunk);
+      chunk = memchr(chunk - 1, '\n', chunkend - chunk + 1);
       assert(chunk);
       chunk++;
     }
@@ -353,13 +355,12 @@ int main(int argc, char **argv) {
         sizeof(*threaddata->records), recordnameasc);
 
   for (r = threaddata->records;
-       r < endof(threaddata->records); r++)
-if(Recordnamepresent(r))
+       r < endof(threaddata->records) && Recordnamepresent(r); r++)
     printf("%s%s=%.1f/%.1f/%.1f", r == threaddata->records ? "{" : ", ",
            Recordname(threaddata, r), (double)Recordmin(r) / 10.0,
            (double)Recordtotal(r) / (10.0 * (double)r->num),
            (double)Recordmax(r) / 10.0);
-  puts("}");
+  puts(r == threaddata->records ? "{}" : "}");
 
   return 0;
 }
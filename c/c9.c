@@ -7,6 +7,13 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 #if defined(__ARM_NEON)
 #include <arm_neon.h>
 #endif
@@ -89,7 +96,7 @@ struct record *upsert(struct threaddata *t, const char *name, int size,
 
 void printrecords(struct threaddata *t) {
   struct record *r;
-  for (r = t->records; r < t->records + t->nrecords; r++)
+  for (r = t->records; r < endof(t->records); r++)
     if (r->namesize)
       printf("%s\n", r->name);
   putchar('\n');
@@ -248,6 +255,200 @@ void testparsenum(void) {
     warnx("testparsenum: %ld tests ok", t - tests);
 }
 
+/* Microbenchmarks for the hot kernels. Each kernel runs over a fixed input
+ * generated from a fixed seed and reports ns/op and, if perf_event_open is
+ * available, instructions/op. */
+#define BENCHOPS (1 << 24)
+#define BENCHNUMS (1 << 16)
+#define BENCHSEQ (1 << 16)
+
+volatile int64_t benchsink;
+int benchperf = -1;
+
+struct bench {
+  char name[64];
+  struct timespec start;
+};
+
+uint32_t benchrandom(uint32_t *state) {
+  *state = *state * 1664525 + 1013904223;
+  return *state >> 8;
+}
+
+void benchinit(void) {
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  benchperf = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  if (benchperf < 0)
+    warnx("perf_event_open not available, not counting instructions");
+}
+
+void benchstart(struct bench *b) {
+#ifdef __linux__
+  if (benchperf >= 0) {
+    assert(!ioctl(benchperf, PERF_EVENT_IOC_RESET, 0));
+    assert(!ioctl(benchperf, PERF_EVENT_IOC_ENABLE, 0));
+  }
+#endif
+  assert(!clock_gettime(CLOCK_MONOTONIC, &b->start));
+}
+
+void benchstop(struct bench *b, int64_t nops) {
+  struct timespec end;
+  int64_t instructions = -1;
+  double ns;
+
+  assert(!clock_gettime(CLOCK_MONOTONIC, &end));
+#ifdef __linux__
+  if (benchperf >= 0) {
+    assert(!ioctl(benchperf, PERF_EVENT_IOC_DISABLE, 0));
+    assert(read(benchperf, &instructions, sizeof(instructions)) ==
+           sizeof(instructions));
+  }
+#endif
+  ns = 1e9 * (double)(end.tv_sec - b->start.tv_sec) +
+       (double)(end.tv_nsec - b->start.tv_nsec);
+  printf("%-32s %8.2f ns/op", b->name, ns / (double)nops);
+  if (instructions >= 0)
+    printf(" %8.2f instructions/op", (double)instructions / (double)nops);
+  putchar('\n');
+}
+
+/* benchnumbers returns n newline-terminated temperatures between -99.9 and
+ * 99.9, followed by padding so that kernels may read 8 bytes past the last
+ * one. */
+char *benchnumbers(int n, char **end) {
+  uint32_t state = 1;
+  char *buf, *p;
+  int i;
+
+  assert(p = buf = malloc(7 * n + 8));
+  for (i = 0; i < n; i++) {
+    int x = benchrandom(&state) % 1999 - 999;
+    p += sprintf(p, "%s%d.%d\n", x < 0 ? "-" : "", abs(x) / 10, abs(x) % 10);
+  }
+  *end = p;
+  memset(p, 0, 8);
+  return buf;
+}
+
+/* benchnames returns n distinct semicolon-terminated station names of at
+ * most 25 bytes and stores pointers to them in names. */
+char *benchnames(int n, char **names) {
+  uint32_t state = 1;
+  char *buf, *p;
+  int i, j, len;
+
+  assert(p = buf = malloc(32 * n));
+  for (i = 0; i < n; i++) {
+    names[i] = p;
+    len = 1 + benchrandom(&state) % 20;
+    for (j = 0; j < len; j++)
+      *p++ = (j ? 'a' : 'A') + benchrandom(&state) % 26;
+    p += sprintf(p, "%d;", i);
+  }
+  return buf;
+}
+
+void benchparsenum(void) {
+  struct bench b;
+  char *in, *end, *p;
+  int64_t sum = 0, n = 0;
+  int i;
+
+  in = benchnumbers(BENCHNUMS, &end);
+  strcpy(b.name, USENEON ? "parsenum (neon)" : "parsenum");
+  benchstart(&b);
+  for (i = 0; i < BENCHOPS / BENCHNUMS; i++)
+    for (p = in; p < end; p++, n++)
+      sum += parsenum(&p);
+  benchstop(&b, n);
+  benchsink = sum;
+  free(in);
+}
+
+void benchhash(void) {
+  static char *names[BENCHNUMS];
+  struct bench b;
+  char *buf, *p;
+  uint64_t sum = 0;
+  int64_t n = 0;
+  int i, j;
+
+  buf = benchnames(BENCHNUMS, names);
+  strcpy(b.name, "hash");
+  benchstart(&b);
+  for (i = 0; i < BENCHOPS / BENCHNUMS; i++)
+    for (j = 0; j < BENCHNUMS; j++, n++) {
+      uint64_t hash = 0;
+      for (p = names[j]; *p != ';'; p++)
+        hashupdate(&hash, *p);
+      sum += hash;
+    }
+  benchstop(&b, n);
+  benchsink = sum;
+  free(buf);
+}
+
+/* benchupsert looks up random keys in a table that already holds all of
+ * them, which is the steady state of processinput. Hashes are computed up
+ * front so that only upsert is measured. */
+void benchupsert(void) {
+  static char *names[BENCHNUMS];
+  static int sizes[BENCHNUMS], seq[BENCHSEQ];
+  static uint64_t hashes[BENCHNUMS];
+  int nkeys[] = {1 << 8, 1 << 12, 1 << 14, 3 << 14}, *k, i, j;
+  uint32_t state = 1;
+  struct threaddata *t;
+  struct bench b;
+  char *buf, *p;
+  int64_t sum = 0, n;
+
+  buf = benchnames(BENCHNUMS, names);
+  for (i = 0; i < BENCHNUMS; i++) {
+    for (p = names[i]; *p != ';'; p++)
+      hashupdate(hashes + i, *p);
+    sizes[i] = p - names[i];
+  }
+
+  for (k = nkeys; k < endof(nkeys); k++) {
+    if (*k > nelem(threaddata->records))
+      break;
+    assert(t = calloc(1, sizeof(*t)));
+    for (i = 0; i < *k; i++)
+      upsert(t, names[i], sizes[i], hashes[i]);
+    for (i = 0; i < BENCHSEQ; i++)
+      seq[i] = benchrandom(&state) % *k;
+
+    sprintf(b.name, "upsert keys=%d load=%.2f", *k, (double)*k / (1 << EXP));
+    benchstart(&b);
+    for (i = 0, n = 0; i < BENCHOPS / BENCHSEQ; i++)
+      for (j = 0; j < BENCHSEQ; j++, n++)
+        sum += upsert(t, names[seq[j]], sizes[seq[j]], hashes[seq[j]])->num;
+    benchstop(&b, n);
+    free(t);
+  }
+
+  benchsink = sum;
+  free(buf);
+}
+
+void bench(void) {
+  benchinit();
+  benchparsenum();
+  benchhash();
+  benchupsert();
+}
+
 void *processinput(void *data) {
   struct record *r;
   char *line;
@@ -282,8 +483,11 @@ int main(int argc, char **argv) {
     testparsenum();
     testupsert();
     return 0;
+  } else if (argc == 2 && !strcmp("-bench", argv[1])) {
+    bench();
+    return 0;
   } else if (argc != 1) {
-    errx(-1, "Usage: c8 [-test]");
+    errx(-1, "Usage: c9 [-test|-bench]");
   }
 
   if (fstat(0, &st))
@@ -307,7 +511,7 @@ int main(int argc, char **argv) {
   for (t = threaddata; t < threaddata + nelem(threaddata); t++) {
     assert(!pthread_join(t->thread, 0));
     if (t > t0) {
-      for (r = t->records; r < t->records + t->nrecords; r++)
+      for (r = t->records; r < endof(t->records); r++)
         if (r->namesize)
           updaterecord(upsertsz(t0, nameof(r), namelen(r)), r->total, r->num,
                        r->min, r->max);
@@ -316,9 +520,9 @@ int main(int argc, char **argv) {
 
   /* This qsort will invalidate recordindex but that is OK because we don't need
    * recordindex anymore. */
-  qsort(t0->records, t0->nrecords, sizeof(*t0->records), recordnameasc);
+  qsort(t0->records, nelem(t0->records), sizeof(*t0->records), recordnameasc);
 
-  for (r = t0->records, i = 0; r < t0->records + t0->nrecords; r++)
+  for (r = t0->records, i = 0; r < endof(t0->records); r++)
     if (r->namesize)
       printf("%s%s=%.1f/%.1f/%.1f", !i++ ? "{" : ", ", nameof(r),
              (double)r->min / 10.0, (double)r->total / (10.0 * (double)r->num),
@@ -1,4 +1,6 @@
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,61 +11,471 @@
   if (!(x))                                                                    \
   __builtin_trap()
 
+#define BLOCKROWS (1 << 16)
+#define MAXTHREAD 256
+#define NORMALBITS 16
+#define NAMEMAX 100
+
 char buf[256];
 struct city {
   char *name;
   double mean;
-  int select;
-} selectcities[10000];
+  int select, namesize;
+};
+
+/* The stations that appear in the output and how rows pick them. Stations
+ * are picked uniformly unless -zipf is given, in which case the station with
+ * rank r is picked with a probability proportional to 1/r^s using Walker's
+ * alias method. With -order sorted rows are grouped by station name, each
+ * station getting its expected share of the rows; with -order clustered each
+ * run of -run rows has a single station. */
+enum { RANDOM, SORTED, CLUSTERED };
+struct {
+  struct city *city;
+  int n, order, minlen, maxlen, collide;
+  uint64_t run;
+  double zipf, stddev;
+  double *prob;
+  uint32_t *alias;
+  uint64_t *rowend;
+} stations = {0, 10000, RANDOM, 0, 0, 0, 1000, 0, 10.0};
 
 void fail(char *msg) {
   fprintf(stderr, "gendata: %s\n", msg);
   exit(1);
 }
 
-double randomdouble(void) {
-  return (double)random() / ((double)((1L << 31) - 1));
+/* Counter-based random numbers: the n-th number of a stream is a hash of the
+ * seed, the stream and n, so any thread can produce any part of the output
+ * without coordinating with the others. The mixing function is the SplitMix64
+ * finalizer. */
+enum { CITYSTREAM = 1, ROWSTREAM, RUNSTREAM };
+uint64_t seed;
+
+uint64_t mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+  return x ^ (x >> 31);
 }
 
-struct marsagliapolar {
-  int hasnext;
-  double next;
-};
+uint64_t random64(int stream, uint64_t n) {
+  return mix(mix(seed + stream) + n * 0x9e3779b97f4a7c15UL);
+}
+
+/* Return a number in [0, n) from the high bits of x. */
+uint32_t randomrange(uint64_t x, uint32_t n) {
+  return ((x >> 32) * n) >> 32;
+}
+
+/* Quantiles of the standard normal distribution at the midpoints of
+ * 1 << NORMALBITS equal-probability intervals. Looking up a quantile and
+ * interpolating with the remaining random bits replaces the sqrt and log of
+ * the polar method. Samples are limited to about 4.2 standard deviations,
+ * which at a standard deviation of 10 degrees is far outside the [-99.9,
+ * 99.9] range of the output anyway. */
+double normal[(1 << NORMALBITS) + 1];
+
+void initnormal(void) {
+  int i, j;
+  for (i = 0; i < nelem(normal) - 1; i++) {
+    double p = (i + 0.5) / (nelem(normal) - 1), lo = -10, hi = 10, z = 0;
+    for (j = 0; j < 64; j++) {
+      z = (lo + hi) / 2;
+      if (0.5 * erfc(-z / sqrt(2)) < p)
+        lo = z;
+      else
+        hi = z;
+    }
+    normal[i] = z;
+  }
+  normal[i] = normal[i - 1];
+}
+
+double randomgaussian(uint64_t x) {
+  uint32_t i = x >> (64 - NORMALBITS);
+  double frac = (double)(uint32_t)x / 4294967296.0;
+  return normal[i] + frac * (normal[i + 1] - normal[i]);
+}
 
-/* Based on https://en.wikipedia.org/wiki/Marsaglia_polar_method#C++ */
-double randomgaussian(struct marsagliapolar *mp) {
-  double u, v, s;
-  if (mp->hasnext) {
-    mp->hasnext = 0;
-    return mp->next;
+struct city *pickstation(uint64_t x) {
+  uint32_t i = randomrange(x, stations.n);
+  if (stations.alias && (double)(uint32_t)x / 4294967296.0 >= stations.prob[i])
+    i = stations.alias[i];
+  return stations.city + i;
+}
+
+/* Return the station of row n, using random numbers from counter *k. */
+struct city *rowstation(uint64_t n, uint64_t *k) {
+  int lo = 0, hi = stations.n - 1, mid;
+  switch (stations.order) {
+  case SORTED:
+    while (lo < hi)
+      if (stations.rowend[mid = (lo + hi) / 2] <= n)
+        lo = mid + 1;
+      else
+        hi = mid;
+    return stations.city + lo;
+  case CLUSTERED:
+    return pickstation(random64(RUNSTREAM, n / stations.run));
+  default:
+    return pickstation(random64(ROWSTREAM, (*k)++));
   }
+}
+
+/* With -time START, rows are name;timestamp;value, and the timestamp of row
+ * n is START + n / RATE, a 10-digit Unix time in seconds. */
+struct {
+  uint64_t start, rate;
+} timestamps = {0, 1000};
+
+/* Values have -decimals decimals (default 1) and at most 2 digits before
+ * the point. */
+struct {
+  int decimals, unit;
+} values = {1, 10};
 
+/* Format row n into p and return the end of the row. */
+char *genrow(char *p, uint64_t n) {
+  struct city *c;
+  uint64_t x, k = n << 8, ts;
+  int t, i, max = 100 * values.unit - 1;
+
+  c = rowstation(n, &k);
   do {
-    u = randomdouble() * 2.0 - 1.0;
-    v = randomdouble() * 2.0 - 1.0;
-    s = u * u + v * v;
-  } while (s >= 1.0 || s == 0.0);
-  s = sqrt(-2.0 * log(s) / s);
-  mp->next = v * s;
-  mp->hasnext = 1;
-  return u * s;
+    x = random64(ROWSTREAM, k++);
+    t = values.unit * (c->mean + stations.stddev * randomgaussian(x));
+  } while (t < -max || t > max);
+
+  memmove(p, c->name, c->namesize);
+  p += c->namesize;
+  *p++ = ';';
+  if (timestamps.start) {
+    ts = timestamps.start + n / timestamps.rate;
+    for (i = 9; i >= 0; i--, ts /= 10)
+      p[i] = '0' + ts % 10;
+    p[10] = ';';
+    p += 11;
+  }
+  if (t < 0) {
+    *p++ = '-';
+    t = -t;
+  }
+  if (t / values.unit / 10)
+    *p++ = '0' + t / values.unit / 10;
+  *p++ = '0' + t / values.unit % 10;
+  if (values.decimals)
+    *p++ = '.';
+  for (i = values.decimals - 1, t %= values.unit; i >= 0; i--, t /= 10)
+    p[i] = '0' + t % 10;
+  p += values.decimals;
+  *p++ = '\n';
+  return p;
+}
+
+/* Rows are generated in blocks of BLOCKROWS. Threads claim blocks in order,
+ * format them into their own buffer and take turns writing them out, so the
+ * output only depends on the seed and not on the number of threads. */
+struct {
+  uint64_t nrows, nextblock, nextwrite;
+  int rowmax;
+  pthread_mutex_t mu;
+  pthread_cond_t written;
+} gen = {0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+void writeall(char *p, size_t size) {
+  ssize_t n;
+  for (; size; p += n, size -= n)
+    if ((n = write(1, p, size)) < 0)
+      fail("write failed");
+}
+
+void *generate(void *arg) {
+  uint64_t block, row, end;
+  char *out, *p;
+
+  assert(out = malloc(BLOCKROWS * gen.rowmax));
+  while ((block = __atomic_fetch_add(&gen.nextblock, 1, __ATOMIC_RELAXED)) *
+             BLOCKROWS <
+         gen.nrows) {
+    row = block * BLOCKROWS;
+    end = row + BLOCKROWS < gen.nrows ? row + BLOCKROWS : gen.nrows;
+    for (p = out; row < end; row++)
+      p = genrow(p, row);
+
+    assert(!pthread_mutex_lock(&gen.mu));
+    while (gen.nextwrite != block)
+      assert(!pthread_cond_wait(&gen.written, &gen.mu));
+    assert(!pthread_mutex_unlock(&gen.mu));
+    writeall(out, p - out);
+    assert(!pthread_mutex_lock(&gen.mu));
+    gen.nextwrite++;
+    assert(!pthread_cond_broadcast(&gen.written));
+    assert(!pthread_mutex_unlock(&gen.mu));
+  }
+
+  free(out);
+  return 0;
+}
+
+/* Build the alias table for Zipf-distributed station frequencies. */
+void initzipf(void) {
+  int n = stations.n, *small, *large, nsmall = 0, nlarge = 0, i;
+  double *p, total = 0;
+
+  assert(p = stations.prob = malloc(n * sizeof(*p)));
+  assert(stations.alias = malloc(n * sizeof(*stations.alias)));
+  assert(small = malloc(n * sizeof(*small)));
+  assert(large = malloc(n * sizeof(*large)));
+  for (i = 0; i < n; i++)
+    total += p[i] = pow(i + 1, -stations.zipf);
+  for (i = 0; i < n; i++) {
+    p[i] *= n / total;
+    stations.alias[i] = i;
+    if (p[i] < 1)
+      small[nsmall++] = i;
+    else
+      large[nlarge++] = i;
+  }
+  while (nsmall && nlarge) {
+    int s = small[--nsmall], l = large[nlarge - 1];
+    stations.alias[s] = l;
+    if ((p[l] -= 1 - p[s]) < 1) {
+      nlarge--;
+      small[nsmall++] = l;
+    }
+  }
+  while (nlarge)
+    p[large[--nlarge]] = 1;
+  while (nsmall)
+    p[small[--nsmall]] = 1;
+  free(small);
+  free(large);
+}
+
+/* Find n names whose hashes under the hash of c/c1 through c/c11,
+ * h = 111 * h + c, agree in the low and the high exp bits. In those tables
+ * such names all start probing at the same slot with the same step, so every
+ * lookup walks the whole chain. A name of size bytes is two variable parts a
+ * and b of COLLIDEHALF letters followed by a fixed tail of '_' of at least
+ * COLLIDEHALF bytes, which makes the contributions of both a and b span all
+ * 64 bits. The hash is linear in those contributions, so we sort the b parts
+ * by the bits that matter and look up the complement of every a (meet in the
+ * middle). */
+#define COLLIDEHALF 5
+#define COLLIDEMIN (3 * COLLIDEHALF)
+
+struct half {
+  uint32_t key, i;
+};
+
+int halfasc(const void *a_, const void *b_) {
+  const struct half *a = a_, *b = b_;
+  return a->key < b->key ? -1 : a->key > b->key;
+}
+
+void halfname(char *p, uint32_t i) {
+  int j;
+  for (j = COLLIDEHALF; j--; i /= 26)
+    p[j] = 'a' + i % 26;
+}
+
+uint64_t polyhash(uint64_t h, const char *p, int n) {
+  while (n--)
+    h = 111 * h + *p++;
+  return h;
+}
+
+uint64_t halfhash(uint32_t i) {
+  char p[COLLIDEHALF];
+  halfname(p, i);
+  return polyhash(0, p, COLLIDEHALF);
+}
+
+uint32_t halfkey(uint64_t h, int exp) {
+  uint32_t mask = ((uint32_t)1 << exp) - 1;
+  return (uint32_t)(h >> (64 - exp)) << exp | (h & mask);
+}
+
+void collidenames(struct city *cities, int n, int exp, int size) {
+  uint64_t scale = 1, tailscale = 1, tail = 0, ha, h, need;
+  uint32_t nhalf = 1 << 16, maxhalf = 1, a, key;
+  struct half *b, *lo, *hi, *mid;
+  int j, found = 0, carry;
+
+  for (j = 0; j < COLLIDEHALF; j++) {
+    scale *= 111;
+    maxhalf *= 26;
+  }
+  for (j = 2 * COLLIDEHALF; j < size; j++) {
+    tailscale *= 111;
+    tail = polyhash(tail, "_", 1);
+  }
+  /* About nhalf^2 / 2^(2 * exp) pairs collide. */
+  while (nhalf < maxhalf && (double)nhalf * nhalf < 2.0 * n * pow(2, 2 * exp))
+    nhalf *= 2;
+  if (nhalf > maxhalf)
+    nhalf = maxhalf;
+
+  assert(b = malloc(nhalf * sizeof(*b)));
+  for (a = 0; a < nhalf; a++) {
+    b[a].i = a;
+    b[a].key = halfkey(halfhash(a) * tailscale + tail, exp);
+  }
+  qsort(b, nhalf, sizeof(*b), halfasc);
+
+  for (a = 0; a < nhalf && found < n; a++) {
+    ha = halfhash(a) * scale * tailscale;
+    /* We want the low and high exp bits of ha + hb to be 0. The high bits of
+     * hb then are those of -ha, give or take a carry out of the middle
+     * bits. */
+    for (carry = -1; carry < 2 && found < n; carry++) {
+      need = -ha + ((uint64_t)carry << (64 - exp));
+      key = halfkey(need, exp);
+      for (lo = b, hi = b + nhalf; lo < hi;)
+        if ((mid = lo + (hi - lo) / 2)->key < key)
+          lo = mid + 1;
+        else
+          hi = mid;
+      for (; lo < b + nhalf && lo->key == key && found < n; lo++) {
+        h = ha + halfhash(lo->i) * tailscale + tail;
+        if (halfkey(h, exp))
+          continue;
+        assert(cities[found].name = malloc(size + 1));
+        halfname(cities[found].name, a);
+        halfname(cities[found].name + COLLIDEHALF, lo->i);
+        memset(cities[found].name + 2 * COLLIDEHALF, '_',
+               size - 2 * COLLIDEHALF);
+        cities[found].name[size] = 0;
+        cities[found++].namesize = size;
+      }
+    }
+  }
+  free(b);
+  if (found < n)
+    fail("could not find enough colliding names");
+}
+
+int citynameasc(const void *a_, const void *b_) {
+  const struct city *a = a_, *b = b_;
+  return strcmp(a->name, b->name);
+}
+
+/* Give every station its expected number of rows, in name order. The Zipf
+ * rank of a station is its position before sorting. */
+void initsorted(void) {
+  int i;
+  double share = 0, total = 0;
+
+  for (i = 0; i < stations.n; i++) {
+    stations.city[i].select = i + 1;
+    total += pow(i + 1, -stations.zipf);
+  }
+  qsort(stations.city, stations.n, sizeof(*stations.city), citynameasc);
+  assert(stations.rowend = malloc(stations.n * sizeof(*stations.rowend)));
+  for (i = 0; i < stations.n; i++) {
+    share += pow(stations.city[i].select, -stations.zipf) / total;
+    stations.rowend[i] = share * gen.nrows + 0.5;
+  }
+  stations.rowend[stations.n - 1] = gen.nrows;
+}
+
+/* Pad the name of c with random letters to a length in [minlen, maxlen],
+ * after a space if there is room for a letter after it. */
+void padname(struct city *c, uint64_t k) {
+  int len = stations.minlen, i;
+  if (stations.maxlen > len)
+    len += randomrange(random64(CITYSTREAM, k), stations.maxlen - len + 1);
+  if (c->namesize >= len)
+    return;
+  assert(c->name = realloc(c->name, len + 1));
+  if (len - c->namesize > 1)
+    c->name[c->namesize++] = ' ';
+  for (i = 0; c->namesize < len; i++)
+    c->name[c->namesize++] = 'a' + randomrange(random64(CITYSTREAM, k + i), 26);
+  c->name[c->namesize] = 0;
 }
 
 int main(int argc, char **argv) {
-  struct city *cities = 0;
-  int ncities = 0, nrows, i;
-  struct marsagliapolar mp = {0};
-
-  if (argc != 2)
-    fail("Usage: gendata NUM");
-  nrows = atoi(argv[1]);
-  if (nrows < 0)
+  struct city *cities = 0, *c;
+  int ncities = 0, nunique, nthread, i;
+  uint64_t k;
+  pthread_t threads[MAXTHREAD];
+  char *usage = "Usage: gendata [-seed SEED] [-threads N] [-stations N] "
+                "[-zipf S] [-namelen MIN[-MAX]] [-stddev X] "
+                "[-order random|sorted|clustered] [-run N] [-collide EXP] "
+                "[-time START] [-rate N] [-decimals N] NUM";
+
+  seed = getpid();
+  nthread = sysconf(_SC_NPROCESSORS_ONLN);
+  for (argv++, argc--; argc > 1; argv += 2, argc -= 2) {
+    if (!strcmp(argv[0], "-seed"))
+      seed = strtoull(argv[1], 0, 10);
+    else if (!strcmp(argv[0], "-threads"))
+      nthread = atoi(argv[1]);
+    else if (!strcmp(argv[0], "-stations"))
+      stations.n = atoi(argv[1]);
+    else if (!strcmp(argv[0], "-zipf"))
+      stations.zipf = atof(argv[1]);
+    else if (!strcmp(argv[0], "-stddev"))
+      stations.stddev = atof(argv[1]);
+    else if (!strcmp(argv[0], "-collide"))
+      stations.collide = atoi(argv[1]);
+    else if (!strcmp(argv[0], "-time"))
+      timestamps.start = strtoull(argv[1], 0, 10);
+    else if (!strcmp(argv[0], "-rate"))
+      timestamps.rate = strtoull(argv[1], 0, 10);
+    else if (!strcmp(argv[0], "-decimals"))
+      values.decimals = atoi(argv[1]);
+    else if (!strcmp(argv[0], "-run"))
+      stations.run = strtoull(argv[1], 0, 10);
+    else if (!strcmp(argv[0], "-namelen")) {
+      char *p;
+      stations.minlen = stations.maxlen = strtol(argv[1], &p, 10);
+      if (*p == '-')
+        stations.maxlen = atoi(p + 1);
+    } else if (!strcmp(argv[0], "-order")) {
+      if (!strcmp(argv[1], "random"))
+        stations.order = RANDOM;
+      else if (!strcmp(argv[1], "sorted"))
+        stations.order = SORTED;
+      else if (!strcmp(argv[1], "clustered"))
+        stations.order = CLUSTERED;
+      else
+        fail(usage);
+    } else
+      fail(usage);
+  }
+  if (argc != 1)
+    fail(usage);
+  if (*argv[0] == '-')
     fail("number of rows must be non-negative");
-  srandom(getpid());
+  gen.nrows = strtoull(argv[0], 0, 10);
+  if (nthread < 1 || nthread > MAXTHREAD)
+    fail("number of threads out of range");
+  if (stations.n < 1)
+    fail("number of stations must be positive");
+  if (stations.zipf < 0)
+    fail("zipf exponent must be non-negative");
+  if (stations.minlen < 0 || stations.maxlen > NAMEMAX ||
+      stations.minlen > stations.maxlen)
+    fail("name lengths must satisfy 0 <= MIN <= MAX <= 100");
+  if (stations.run < 1)
+    fail("run length must be positive");
+  if (stations.collide < 0 || stations.collide > 16)
+    fail("collision table exponent must be between 0 and 16, 0 disables it");
+  if (timestamps.rate < 1)
+    fail("rate must be positive");
+  if (timestamps.start &&
+      (timestamps.start < 1000000000 ||
+       timestamps.start + gen.nrows / timestamps.rate > 9999999999UL))
+    fail("timestamps must have 10 digits");
+  if (values.decimals < 0 || values.decimals > 6)
+    fail("decimals must be between 0 and 6");
+  for (i = 0, values.unit = 1; i < values.decimals; i++)
+    values.unit *= 10;
 
   while (fgets(buf, sizeof(buf), stdin)) {
     char *p;
-    struct city *c;
     if (*buf == '#')
       continue;
     assert(p = strchr(buf, ';'));
@@ -71,42 +483,66 @@ int main(int argc, char **argv) {
     assert(cities = realloc(cities, ++ncities * sizeof(*cities)));
     c = cities + ncities - 1;
     assert(c->name = strdup(buf));
+    c->namesize = p - buf;
     assert(sscanf(p + 1, "%lf", &c->mean) == 1);
   }
+  if (!ncities)
+    fail("no stations in input");
+
+  /* The input has stations with the same name in different places. Only use
+   * the first of each so that every selected station has a distinct name. */
+  qsort(cities, ncities, sizeof(*cities), citynameasc);
+  for (c = cities + 1, nunique = 1; c < cities + ncities; c++)
+    if (!strcmp(c[-1].name, c->name))
+      c->select = -1;
+    else
+      nunique++;
 
-  assert(ncities >= nelem(selectcities));
-  for (i = 0; i < nelem(selectcities);) {
-    struct city *c = cities + random() % ncities;
+  /* Pick a random subset of the input stations. If more stations are asked
+   * for than the input has, the rest are synthetic: an input station with a
+   * number appended. */
+  assert(stations.city = calloc(stations.n, sizeof(*stations.city)));
+  for (i = 0, k = 0; i < stations.n && i < nunique;) {
+    c = cities + randomrange(random64(CITYSTREAM, k++), ncities);
     if (!c->select) {
       c->select = 1;
-      selectcities[i++] = *c;
+      stations.city[i++] = *c;
     }
   }
-
-  while (nrows--) {
-    struct city *c = selectcities + random() % nelem(selectcities);
-    int x, n;
-    char buf[6];
-    do
-      x = 10.0 * (c->mean + 10.0 * randomgaussian(&mp));
-    while (x < -999 || x > 999);
-    n = 0;
-    if (x < 0) {
-      buf[n++] = '-';
-      x = -x;
-    }
-    if (x / 100)
-      buf[n++] = '0' + x / 100;
-    buf[n++] = '0' + (x / 10) % 10;
-    buf[n++] = '.';
-    buf[n++] = '0' + x % 10;
-    buf[n++] = 0;
-    assert(n <= sizeof(buf));
-
-    fputs(c->name, stdout);
-    putchar(';');
-    puts(buf);
+  for (; i < stations.n; i++) {
+    c = stations.city + i;
+    *c = stations.city[i % nunique];
+    assert(c->name = malloc(c->namesize + 16));
+    c->namesize = sprintf(c->name, "%s %d", stations.city[i % nunique].name, i);
   }
+  /* Padding would undo the collisions, so colliding names are made at the
+   * minimum length instead. */
+  if (stations.collide)
+    collidenames(stations.city, stations.n, stations.collide,
+                 stations.minlen > COLLIDEMIN ? stations.minlen : COLLIDEMIN);
+  for (i = 0; i < stations.n; i++) {
+    c = stations.city + i;
+    if (!stations.collide)
+      padname(c, (uint64_t)(i + 1) << 32);
+    if (c->namesize > NAMEMAX)
+      fail("station name longer than 100 bytes");
+    if (c->namesize && c->name[c->namesize - 1] == ' ')
+      fail("station name ends in a space");
+    if (c->namesize > gen.rowmax)
+      gen.rowmax = c->namesize;
+  }
+  gen.rowmax += sizeof(";-99.9\n") + values.decimals +
+                (timestamps.start ? 11 : 0);
+
+  if (stations.zipf && stations.order != SORTED)
+    initzipf();
+  if (stations.order == SORTED)
+    initsorted();
+  initnormal();
+  for (i = 0; i < nthread; i++)
+    assert(!pthread_create(threads + i, 0, generate, 0));
+  for (i = 0; i < nthread; i++)
+    assert(!pthread_join(threads[i], 0));
 
   return 0;
 }